@@ -0,0 +1,357 @@
+/* wipe
+ *
+ * by Berke Durak
+ *
+ * AES in counter mode, using AES-NI or VAES when available.
+ *
+ */
+
+/* AES-128 or AES-256 encrypts successive counter blocks to produce the
+ * stream, much as the RC6 generator was meant to.  On x86 processors
+ * with the AES-NI instructions eight blocks are kept in flight to hide
+ * the latency of aesenc; with VAES and AVX-512, sixteen blocks are
+ * encrypted four to a register.  The choice is made at run-time.
+ *
+ * The portable fallback does not use lookup tables: the S-box is
+ * computed as the multiplicative inverse in GF(2^8) (raising to the
+ * power 254) followed by the affine map, eight bytes at a time in a
+ * 64-bit word.  It is constant-time but slow; ChaCha20 is a much better
+ * choice on processors without AES instructions.
+ */
+
+#include <string.h>
+
+#include "aes.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AES_X86
+#include <immintrin.h>
+#endif
+
+typedef size_t (*aes_kernel_t) (const struct aes_KeySchedule *ks, uint64_t ctr, u8 *b, size_t n);
+
+/*** table-free S-box */
+
+#define LO8 0x0101010101010101ULL
+
+static uint64_t aes_xtime64 (uint64_t a)
+{
+  return ((a & 0x7f7f7f7f7f7f7f7fULL) << 1) ^ (((a >> 7) & LO8) * 0x1b);
+}
+
+/* multiplies the eight bytes of a by those of b in GF(2^8) */
+
+static uint64_t aes_mul64 (uint64_t a, uint64_t b)
+{
+  uint64_t r = 0;
+  int i;
+
+  for (i = 0; i<8; i++) {
+    r ^= a & (((b >> i) & LO8) * 0xff);
+    a = aes_xtime64 (a);
+  }
+  return r;
+}
+
+#define ROTL8x8(v, n) ((((v) << (n)) & (((0xff << (n)) & 0xff) * LO8)) | \
+                       (((v) >> (8 - (n))) & ((0xff >> (8 - (n))) * LO8)))
+
+static uint64_t aes_sbox64 (uint64_t x)
+{
+  uint64_t x2, x3, x12, x15, y;
+
+  /* x^254 = x^-1, with x^-1 = 0 for x = 0 */
+  x2 = aes_mul64 (x, x);
+  x3 = aes_mul64 (x2, x);
+  x12 = aes_mul64 (x3, x3); x12 = aes_mul64 (x12, x12);
+  x15 = aes_mul64 (x12, x3);
+  y = aes_mul64 (x15, x15);			/* 30 */
+  y = aes_mul64 (y, y);				/* 60 */
+  y = aes_mul64 (y, y);				/* 120 */
+  y = aes_mul64 (y, y);				/* 240 */
+  y = aes_mul64 (y, x12);			/* 252 */
+  y = aes_mul64 (y, x2);			/* 254 */
+
+  return y ^ ROTL8x8 (y, 1) ^ ROTL8x8 (y, 2) ^ ROTL8x8 (y, 3) ^ ROTL8x8 (y, 4) ^ (0x63 * LO8);
+}
+
+/* table-free S-box ***/
+
+/*** portable kernel */
+
+static u8 aes_xtime (u8 a)
+{
+  return (a << 1) ^ (0x1b & -(a >> 7));
+}
+
+static void aes_encrypt_c (const struct aes_KeySchedule *ks, u8 *s)
+{
+  uint64_t h[2];
+  u8 t[16];
+  int i, r, c;
+
+  for (i = 0; i<16; i++) s[i] ^= ks->rk[i];
+
+  for (r = 1; r <= ks->rounds; r++) {
+    memcpy (h, s, 16);
+    h[0] = aes_sbox64 (h[0]);
+    h[1] = aes_sbox64 (h[1]);
+    memcpy (s, h, 16);
+
+    /* ShiftRows: byte 4c+i is row i, column c */
+    for (c = 0; c<4; c++)
+      for (i = 0; i<4; i++)
+        t[4*c + i] = s[4*((c + i) & 3) + i];
+
+    if (r != ks->rounds) {
+      for (c = 0; c<4; c++) {
+        u8 a0 = t[4*c], a1 = t[4*c+1], a2 = t[4*c+2], a3 = t[4*c+3];
+        u8 x = a0 ^ a1 ^ a2 ^ a3;
+
+        t[4*c]   = a0 ^ x ^ aes_xtime (a0 ^ a1);
+        t[4*c+1] = a1 ^ x ^ aes_xtime (a1 ^ a2);
+        t[4*c+2] = a2 ^ x ^ aes_xtime (a2 ^ a3);
+        t[4*c+3] = a3 ^ x ^ aes_xtime (a3 ^ a0);
+      }
+    }
+
+    for (i = 0; i<16; i++) s[i] = t[i] ^ ks->rk[AES_BLOCK*r + i];
+  }
+}
+
+static void aes_counter_block (const struct aes_KeySchedule *ks, uint64_t ctr, u8 *b)
+{
+  int i;
+
+  for (i = 0; i<8; i++) {
+    b[i] = ks->nonce >> (56 - 8*i);
+    b[8+i] = ctr >> (56 - 8*i);
+  }
+}
+
+static size_t aes_blocks_c (const struct aes_KeySchedule *ks, uint64_t ctr, u8 *b, size_t n)
+{
+  size_t k;
+
+  for (k = 0; k<n; k++, ctr++, b += AES_BLOCK) {
+    aes_counter_block (ks, ctr, b);
+    aes_encrypt_c (ks, b);
+  }
+  return n;
+}
+
+/* portable kernel ***/
+
+#ifdef AES_X86
+
+/*** AES-NI kernel, 8 blocks in flight */
+
+#define AESNI_WAY 8
+
+__attribute__ ((target ("aes,sse4.1")))
+static size_t aes_blocks_ni (const struct aes_KeySchedule *ks, uint64_t ctr, u8 *b, size_t n)
+{
+  __m128i rk[15], x[AESNI_WAY];
+  __m128i nonce;
+  size_t k;
+  int i, r;
+
+  for (r = 0; r <= ks->rounds; r++)
+    rk[r] = _mm_loadu_si128 ((const __m128i *) (ks->rk + AES_BLOCK*r));
+  nonce = _mm_set_epi64x (0, __builtin_bswap64 (ks->nonce));
+
+  for (k = 0; k + AESNI_WAY <= n; k += AESNI_WAY, b += AESNI_WAY * AES_BLOCK) {
+    for (i = 0; i<AESNI_WAY; i++, ctr++)
+      x[i] = _mm_xor_si128 (_mm_insert_epi64 (nonce, __builtin_bswap64 (ctr), 1), rk[0]);
+
+    for (r = 1; r<ks->rounds; r++)
+      for (i = 0; i<AESNI_WAY; i++) x[i] = _mm_aesenc_si128 (x[i], rk[r]);
+
+    for (i = 0; i<AESNI_WAY; i++) {
+      x[i] = _mm_aesenclast_si128 (x[i], rk[ks->rounds]);
+      _mm_storeu_si128 ((__m128i *) (b + AES_BLOCK*i), x[i]);
+    }
+  }
+
+  for (; k<n; k++, ctr++, b += AES_BLOCK) {
+    x[0] = _mm_xor_si128 (_mm_insert_epi64 (nonce, __builtin_bswap64 (ctr), 1), rk[0]);
+    for (r = 1; r<ks->rounds; r++) x[0] = _mm_aesenc_si128 (x[0], rk[r]);
+    _mm_storeu_si128 ((__m128i *) b, _mm_aesenclast_si128 (x[0], rk[ks->rounds]));
+  }
+
+  return n;
+}
+
+/* AES-NI kernel, 8 blocks in flight ***/
+
+/*** VAES kernel, 16 blocks in flight */
+
+#define VAES_WAY 4	/* registers of four blocks each */
+
+__attribute__ ((target ("avx512f,vaes")))
+static size_t aes_blocks_vaes (const struct aes_KeySchedule *ks, uint64_t ctr, u8 *b, size_t n)
+{
+  __m512i rk[15], x[VAES_WAY];
+  long long nonce;
+  size_t k;
+  int i, r;
+
+  for (r = 0; r <= ks->rounds; r++)
+    rk[r] = _mm512_broadcast_i32x4 (_mm_loadu_si128 ((const __m128i *) (ks->rk + AES_BLOCK*r)));
+  nonce = __builtin_bswap64 (ks->nonce);
+
+  for (k = 0; k + 4*VAES_WAY <= n; k += 4*VAES_WAY, b += 4*VAES_WAY * AES_BLOCK) {
+    for (i = 0; i<VAES_WAY; i++, ctr += 4)
+      x[i] = _mm512_xor_si512 (_mm512_set_epi64 (
+            __builtin_bswap64 (ctr + 3), nonce, __builtin_bswap64 (ctr + 2), nonce,
+            __builtin_bswap64 (ctr + 1), nonce, __builtin_bswap64 (ctr), nonce), rk[0]);
+
+    for (r = 1; r<ks->rounds; r++)
+      for (i = 0; i<VAES_WAY; i++) x[i] = _mm512_aesenc_epi128 (x[i], rk[r]);
+
+    for (i = 0; i<VAES_WAY; i++) {
+      x[i] = _mm512_aesenclast_epi128 (x[i], rk[ks->rounds]);
+      _mm512_storeu_si512 (b + 4*AES_BLOCK*i, x[i]);
+    }
+  }
+
+  return k + aes_blocks_ni (ks, ctr, b, n - k);
+}
+
+/* VAES kernel, 16 blocks in flight ***/
+
+#endif
+
+/*** kernel selection */
+
+static aes_kernel_t aes_kernel = 0;
+static const char *aes_kernel_name = "c";
+
+static void aes_SelectKernel (void)
+{
+  if (aes_kernel) return;
+
+  aes_kernel = aes_blocks_c;
+  aes_kernel_name = "c";
+
+#ifdef AES_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("aes") && __builtin_cpu_supports ("sse4.1")) {
+    aes_kernel = aes_blocks_ni;
+    aes_kernel_name = "aes-ni";
+    if (__builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("vaes")) {
+      aes_kernel = aes_blocks_vaes;
+      aes_kernel_name = "vaes";
+    }
+  }
+#endif
+}
+
+const char *aes_KernelName (void)
+{
+  aes_SelectKernel ();
+  return aes_kernel_name;
+}
+
+/* kernel selection ***/
+
+/* n is 16 (AES-128) or 32 (AES-256) */
+
+void aes_SetupKey (u8 *k, int n, struct aes_KeySchedule *ks)
+{
+  int nk, i, j;
+  u8 rcon, *w;
+
+  aes_SelectKernel ();
+
+  nk = n / 4;
+  ks->rounds = nk + 6;
+  ks->nonce = 0;
+  w = ks->rk;
+
+  memcpy (w, k, n);
+  for (rcon = 1, i = nk; i < 4 * (ks->rounds + 1); i++) {
+    u8 t[4];
+    uint64_t h = 0;
+
+    memcpy (t, w + 4*(i-1), 4);
+    if (!(i % nk)) {
+      u8 x = t[0];
+
+      t[0] = t[1]; t[1] = t[2]; t[2] = t[3]; t[3] = x;
+    }
+    if (!(i % nk) || (nk > 6 && i % nk == 4)) {
+      memcpy (&h, t, 4);
+      h = aes_sbox64 (h);
+      memcpy (t, &h, 4);
+    }
+    if (!(i % nk)) {
+      t[0] ^= rcon;
+      rcon = aes_xtime (rcon);
+    }
+    for (j = 0; j<4; j++) w[4*i + j] = w[4*(i-nk) + j] ^ t[j];
+  }
+}
+
+void aes_SetupNonce (uint64_t nonce, struct aes_KeySchedule *ks)
+{
+  ks->nonce = nonce;
+}
+
+/* encrypts n counter blocks, starting with block number ctr */
+
+void aes_Blocks (const struct aes_KeySchedule *ks, uint64_t ctr, u8 *b, size_t n)
+{
+  aes_kernel (ks, ctr, b, n);
+}
+
+#ifdef TEST_AES
+#include <stdio.h>
+
+/* FIPS-197, appendix C: the plaintext 00112233...ff is our counter
+ * block for nonce 0x0011223344556677 and counter 0x8899aabbccddeeff. */
+
+static u8 test_key[32] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+};
+
+static u8 test_ct128[16] = {
+  0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a
+};
+
+static u8 test_ct256[16] = {
+  0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89
+};
+
+int main (int argc, char **argv)
+{
+  struct aes_KeySchedule ks;
+  static u8 a[16*37], c[16*37];
+  int n;
+
+  for (n = 16; n <= 32; n += 16) {
+    aes_SetupKey (test_key, n, &ks);
+    aes_SetupNonce (0x0011223344556677ULL, &ks);
+
+    aes_blocks_c (&ks, 0x8899aabbccddeeffULL, a, 1);
+    if (memcmp (a, n == 16 ? test_ct128 : test_ct256, 16)) {
+      printf ("FAIL: AES-%d test vector\n", 8*n);
+      return 1;
+    }
+
+    /* the accelerated kernel must agree with the portable one */
+    aes_Blocks (&ks, 0xfffffffffffffff0ULL, a, 37);
+    aes_blocks_c (&ks, 0xfffffffffffffff0ULL, c, 37);
+    if (memcmp (a, c, sizeof (a))) {
+      printf ("FAIL: AES-%d %s kernel\n", 8*n, aes_KernelName ());
+      return 1;
+    }
+  }
+
+  printf ("OK (%s kernel)\n", aes_KernelName ());
+  return 0;
+}
+#endif
+
+/* vim:set sw=4:set ts=8: */
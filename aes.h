@@ -0,0 +1,36 @@
+/* wipe
+ *
+ * by Berke Durak
+ *
+ * AES in counter mode, using AES-NI or VAES when available.
+ *
+ */
+
+#ifndef AES_H
+#define AES_H
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef U32U16U8
+typedef unsigned long u32;
+typedef unsigned short u16;
+typedef unsigned char u8;
+#define U32U16U8
+#endif
+
+#define AES_BLOCK 16
+
+/* counter blocks are made of the 64-bit nonce followed by the 64-bit
+ * block counter, both big-endian. */
+
+struct aes_KeySchedule {
+	u8 rk[15 * AES_BLOCK];	/* round keys, in FIPS-197 byte order */
+	int rounds;
+	uint64_t nonce;
+};
+
+void aes_SetupKey (u8 *k, int n, struct aes_KeySchedule *ks);
+void aes_SetupNonce (uint64_t nonce, struct aes_KeySchedule *ks);
+void aes_Blocks (const struct aes_KeySchedule *ks, uint64_t ctr, u8 *b, size_t n);
+const char *aes_KernelName (void);
+#endif
@@ -0,0 +1,401 @@
+/* wipe
+ *
+ * by Berke Durak
+ *
+ * ChaCha20 keystream generator, with SIMD kernels selected at run-time.
+ *
+ */
+
+/* ChaCha20 is D.J. Bernstein's stream cipher.  It is used here purely as
+ * a fast PRNG: unlike arcfour, which has to be cranked one byte at a
+ * time, every 64-byte block of the stream is a function of the key and of
+ * its block number only.  This lets us compute several blocks at once in
+ * the lanes of a vector register: 4 blocks with SSE2, 8 with AVX2 and 16
+ * with AVX-512.  The widest kernel supported by the CPU is picked the
+ * first time a key is set up; the plain C kernel is used everywhere else.
+ */
+
+#include <string.h>
+
+#include "chacha.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHACHA_X86
+#include <immintrin.h>
+#endif
+
+#define CHACHA_ROUNDS 20
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, a, b, c, d) \
+  a = ADD (a, b); d = XOR (d, a); d = ROT16 (d); \
+  c = ADD (c, d); b = XOR (b, c); b = ROT12 (b); \
+  a = ADD (a, b); d = XOR (d, a); d = ROT8 (d); \
+  c = ADD (c, d); b = XOR (b, c); b = ROT7 (b)
+
+#define DOUBLEROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, x) \
+  QUARTERROUND (ADD, XOR, ROT16, ROT12, ROT8, ROT7, x[0], x[4], x[8],  x[12]); \
+  QUARTERROUND (ADD, XOR, ROT16, ROT12, ROT8, ROT7, x[1], x[5], x[9],  x[13]); \
+  QUARTERROUND (ADD, XOR, ROT16, ROT12, ROT8, ROT7, x[2], x[6], x[10], x[14]); \
+  QUARTERROUND (ADD, XOR, ROT16, ROT12, ROT8, ROT7, x[3], x[7], x[11], x[15]); \
+  QUARTERROUND (ADD, XOR, ROT16, ROT12, ROT8, ROT7, x[0], x[5], x[10], x[15]); \
+  QUARTERROUND (ADD, XOR, ROT16, ROT12, ROT8, ROT7, x[1], x[6], x[11], x[12]); \
+  QUARTERROUND (ADD, XOR, ROT16, ROT12, ROT8, ROT7, x[2], x[7], x[8],  x[13]); \
+  QUARTERROUND (ADD, XOR, ROT16, ROT12, ROT8, ROT7, x[3], x[4], x[9],  x[14])
+
+/* a kernel generates blocks ctr, ctr+1, ... into b and returns the number
+ * of blocks it could do; it may stop early, either because fewer blocks
+ * than its width remain or because the low counter word would wrap
+ * inside a batch. chacha_Blocks () does the leftovers in plain C.
+ */
+
+typedef size_t (*chacha_kernel_t) (const uint32_t *s, uint64_t ctr, u8 *b, size_t n);
+
+/*** scalar kernel */
+
+#define S_ADD(a, b) ((a) + (b))
+#define S_XOR(a, b) ((a) ^ (b))
+#define S_ROT16(v) ROTL32 (v, 16)
+#define S_ROT12(v) ROTL32 (v, 12)
+#define S_ROT8(v)  ROTL32 (v, 8)
+#define S_ROT7(v)  ROTL32 (v, 7)
+
+static size_t chacha_blocks_c (const uint32_t *s, uint64_t ctr, u8 *b, size_t n)
+{
+  uint32_t x[16], o[16];
+  size_t k;
+  int i;
+
+  for (k = 0; k<n; k++, ctr++, b += CHACHA_BLOCK) {
+    memcpy (o, s, sizeof (o));
+    o[12] = (uint32_t) ctr;
+    o[13] = (uint32_t) (ctr >> 32);
+    memcpy (x, o, sizeof (x));
+
+    for (i = 0; i<CHACHA_ROUNDS; i += 2) {
+      DOUBLEROUND (S_ADD, S_XOR, S_ROT16, S_ROT12, S_ROT8, S_ROT7, x);
+    }
+
+    for (i = 0; i<16; i++) {
+      uint32_t v = x[i] + o[i];
+
+      b[4*i]   = v;
+      b[4*i+1] = v >> 8;
+      b[4*i+2] = v >> 16;
+      b[4*i+3] = v >> 24;
+    }
+  }
+
+  return n;
+}
+
+/* scalar kernel ***/
+
+#ifdef CHACHA_X86
+
+/* the vector kernels keep word i of W consecutive blocks in the W lanes
+ * of x[i].  once the rounds are done, the four words of a group
+ * i = 4g..4g+3 are transposed inside each 128-bit lane, so that
+ * y[g][r] holds, in its 128-bit lane k, words 4g..4g+3 of block 4k+r.
+ * what remains is to gather the 128-bit lanes back into whole blocks.
+ */
+
+#define TRANSPOSE4(UNPACKLO32, UNPACKHI32, UNPACKLO64, UNPACKHI64, x0, x1, x2, x3, y0, y1, y2, y3) \
+  { \
+    t0 = UNPACKLO32 (x0, x1); t1 = UNPACKLO32 (x2, x3); \
+    t2 = UNPACKHI32 (x0, x1); t3 = UNPACKHI32 (x2, x3); \
+    y0 = UNPACKLO64 (t0, t1); y1 = UNPACKHI64 (t0, t1); \
+    y2 = UNPACKLO64 (t2, t3); y3 = UNPACKHI64 (t2, t3); \
+  }
+
+/*** SSE2 kernel, 4 blocks */
+
+#define SSE_ROT(v, n) _mm_or_si128 (_mm_slli_epi32 (v, n), _mm_srli_epi32 (v, 32 - (n)))
+#define SSE_ROT16(v) SSE_ROT (v, 16)
+#define SSE_ROT12(v) SSE_ROT (v, 12)
+#define SSE_ROT8(v)  SSE_ROT (v, 8)
+#define SSE_ROT7(v)  SSE_ROT (v, 7)
+
+__attribute__ ((target ("sse2")))
+static size_t chacha_blocks_sse2 (const uint32_t *s, uint64_t ctr, u8 *b, size_t n)
+{
+  __m128i x[16], o[16], y[4][4];
+  __m128i t0, t1, t2, t3;
+  size_t k;
+  int i, g, r;
+
+  for (k = 0; k + 4 <= n; k += 4, ctr += 4, b += 4 * CHACHA_BLOCK) {
+    if ((uint32_t) ctr > 0xffffffffU - 3) break;
+
+    for (i = 0; i<16; i++) o[i] = _mm_set1_epi32 (s[i]);
+    o[12] = _mm_add_epi32 (_mm_set1_epi32 ((uint32_t) ctr), _mm_set_epi32 (3, 2, 1, 0));
+    o[13] = _mm_set1_epi32 ((uint32_t) (ctr >> 32));
+    for (i = 0; i<16; i++) x[i] = o[i];
+
+    for (i = 0; i<CHACHA_ROUNDS; i += 2) {
+      DOUBLEROUND (_mm_add_epi32, _mm_xor_si128, SSE_ROT16, SSE_ROT12, SSE_ROT8, SSE_ROT7, x);
+    }
+
+    for (i = 0; i<16; i++) x[i] = _mm_add_epi32 (x[i], o[i]);
+
+    for (g = 0; g<4; g++)
+      TRANSPOSE4 (_mm_unpacklo_epi32, _mm_unpackhi_epi32, _mm_unpacklo_epi64, _mm_unpackhi_epi64,
+          x[4*g], x[4*g+1], x[4*g+2], x[4*g+3], y[g][0], y[g][1], y[g][2], y[g][3]);
+
+    for (r = 0; r<4; r++)
+      for (g = 0; g<4; g++)
+        _mm_storeu_si128 ((__m128i *) (b + CHACHA_BLOCK*r + 16*g), y[g][r]);
+  }
+
+  return k;
+}
+
+/* SSE2 kernel, 4 blocks ***/
+
+/*** AVX2 kernel, 8 blocks */
+
+#define AVX2_ROT(v, n) _mm256_or_si256 (_mm256_slli_epi32 (v, n), _mm256_srli_epi32 (v, 32 - (n)))
+#define AVX2_ROT16(v) _mm256_shuffle_epi8 (v, rot16)
+#define AVX2_ROT12(v) AVX2_ROT (v, 12)
+#define AVX2_ROT8(v)  _mm256_shuffle_epi8 (v, rot8)
+#define AVX2_ROT7(v)  AVX2_ROT (v, 7)
+
+__attribute__ ((target ("avx2")))
+static size_t chacha_blocks_avx2 (const uint32_t *s, uint64_t ctr, u8 *b, size_t n)
+{
+  __m256i x[16], o[16], y[4][4];
+  __m256i t0, t1, t2, t3;
+  __m256i rot16, rot8;
+  size_t k;
+  int i, g, r;
+
+  rot16 = _mm256_set_epi8 (13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                           13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+  rot8 =  _mm256_set_epi8 (14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+                           14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+
+  for (k = 0; k + 8 <= n; k += 8, ctr += 8, b += 8 * CHACHA_BLOCK) {
+    if ((uint32_t) ctr > 0xffffffffU - 7) break;
+
+    for (i = 0; i<16; i++) o[i] = _mm256_set1_epi32 (s[i]);
+    o[12] = _mm256_add_epi32 (_mm256_set1_epi32 ((uint32_t) ctr),
+        _mm256_set_epi32 (7, 6, 5, 4, 3, 2, 1, 0));
+    o[13] = _mm256_set1_epi32 ((uint32_t) (ctr >> 32));
+    for (i = 0; i<16; i++) x[i] = o[i];
+
+    for (i = 0; i<CHACHA_ROUNDS; i += 2) {
+      DOUBLEROUND (_mm256_add_epi32, _mm256_xor_si256, AVX2_ROT16, AVX2_ROT12, AVX2_ROT8, AVX2_ROT7, x);
+    }
+
+    for (i = 0; i<16; i++) x[i] = _mm256_add_epi32 (x[i], o[i]);
+
+    for (g = 0; g<4; g++)
+      TRANSPOSE4 (_mm256_unpacklo_epi32, _mm256_unpackhi_epi32, _mm256_unpacklo_epi64, _mm256_unpackhi_epi64,
+          x[4*g], x[4*g+1], x[4*g+2], x[4*g+3], y[g][0], y[g][1], y[g][2], y[g][3]);
+
+    /* lane 0 holds block r, lane 1 block 4+r */
+    for (r = 0; r<4; r++) {
+      u8 *b0 = b + CHACHA_BLOCK*r, *b1 = b + CHACHA_BLOCK*(4+r);
+
+      _mm256_storeu_si256 ((__m256i *) b0,        _mm256_permute2x128_si256 (y[0][r], y[1][r], 0x20));
+      _mm256_storeu_si256 ((__m256i *) (b0 + 32), _mm256_permute2x128_si256 (y[2][r], y[3][r], 0x20));
+      _mm256_storeu_si256 ((__m256i *) b1,        _mm256_permute2x128_si256 (y[0][r], y[1][r], 0x31));
+      _mm256_storeu_si256 ((__m256i *) (b1 + 32), _mm256_permute2x128_si256 (y[2][r], y[3][r], 0x31));
+    }
+  }
+
+  return k;
+}
+
+/* AVX2 kernel, 8 blocks ***/
+
+/*** AVX-512 kernel, 16 blocks */
+
+#define AVX512_ROT16(v) _mm512_rol_epi32 (v, 16)
+#define AVX512_ROT12(v) _mm512_rol_epi32 (v, 12)
+#define AVX512_ROT8(v)  _mm512_rol_epi32 (v, 8)
+#define AVX512_ROT7(v)  _mm512_rol_epi32 (v, 7)
+
+__attribute__ ((target ("avx512f")))
+static size_t chacha_blocks_avx512 (const uint32_t *s, uint64_t ctr, u8 *b, size_t n)
+{
+  __m512i x[16], o[16], y[4][4];
+  __m512i t0, t1, t2, t3;
+  size_t k;
+  int i, g, r;
+
+  for (k = 0; k + 16 <= n; k += 16, ctr += 16, b += 16 * CHACHA_BLOCK) {
+    if ((uint32_t) ctr > 0xffffffffU - 15) break;
+
+    for (i = 0; i<16; i++) o[i] = _mm512_set1_epi32 (s[i]);
+    o[12] = _mm512_add_epi32 (_mm512_set1_epi32 ((uint32_t) ctr),
+        _mm512_set_epi32 (15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+    o[13] = _mm512_set1_epi32 ((uint32_t) (ctr >> 32));
+    for (i = 0; i<16; i++) x[i] = o[i];
+
+    for (i = 0; i<CHACHA_ROUNDS; i += 2) {
+      DOUBLEROUND (_mm512_add_epi32, _mm512_xor_si512, AVX512_ROT16, AVX512_ROT12, AVX512_ROT8, AVX512_ROT7, x);
+    }
+
+    for (i = 0; i<16; i++) x[i] = _mm512_add_epi32 (x[i], o[i]);
+
+    for (g = 0; g<4; g++)
+      TRANSPOSE4 (_mm512_unpacklo_epi32, _mm512_unpackhi_epi32, _mm512_unpacklo_epi64, _mm512_unpackhi_epi64,
+          x[4*g], x[4*g+1], x[4*g+2], x[4*g+3], y[g][0], y[g][1], y[g][2], y[g][3]);
+
+    /* lane k of y[0..3][r] makes up block 4k+r: transpose the 4x4 matrix
+     * of 128-bit lanes */
+    for (r = 0; r<4; r++) {
+      __m512i a, c, d, e;
+
+      a = _mm512_shuffle_i32x4 (y[0][r], y[1][r], 0x44);
+      c = _mm512_shuffle_i32x4 (y[2][r], y[3][r], 0x44);
+      d = _mm512_shuffle_i32x4 (y[0][r], y[1][r], 0xee);
+      e = _mm512_shuffle_i32x4 (y[2][r], y[3][r], 0xee);
+
+      _mm512_storeu_si512 (b + CHACHA_BLOCK*r,      _mm512_shuffle_i32x4 (a, c, 0x88));
+      _mm512_storeu_si512 (b + CHACHA_BLOCK*(4+r),  _mm512_shuffle_i32x4 (a, c, 0xdd));
+      _mm512_storeu_si512 (b + CHACHA_BLOCK*(8+r),  _mm512_shuffle_i32x4 (d, e, 0x88));
+      _mm512_storeu_si512 (b + CHACHA_BLOCK*(12+r), _mm512_shuffle_i32x4 (d, e, 0xdd));
+    }
+  }
+
+  return k;
+}
+
+/* AVX-512 kernel, 16 blocks ***/
+
+#endif
+
+/*** kernel selection */
+
+static chacha_kernel_t chacha_kernel = 0;
+static const char *chacha_kernel_name = "c";
+
+static void chacha_SelectKernel (void)
+{
+  if (chacha_kernel) return;
+
+  chacha_kernel = chacha_blocks_c;
+  chacha_kernel_name = "c";
+
+#ifdef CHACHA_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx512f")) {
+    chacha_kernel = chacha_blocks_avx512;
+    chacha_kernel_name = "avx512";
+  } else if (__builtin_cpu_supports ("avx2")) {
+    chacha_kernel = chacha_blocks_avx2;
+    chacha_kernel_name = "avx2";
+  } else if (__builtin_cpu_supports ("sse2")) {
+    chacha_kernel = chacha_blocks_sse2;
+    chacha_kernel_name = "sse2";
+  }
+#endif
+}
+
+const char *chacha_KernelName (void)
+{
+  chacha_SelectKernel ();
+  return chacha_kernel_name;
+}
+
+/* kernel selection ***/
+
+static uint32_t chacha_load32 (u8 *p)
+{
+  return p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/* n is 16 or 32 (bytes); a 128-bit key is repeated, as in the original
+ * "expand 16-byte k" variant of Salsa20/ChaCha.
+ */
+
+void chacha_SetupKey (u8 *k, int n, struct chacha_KeySchedule *ks)
+{
+  static u8 sigma[16] = "expand 32-byte k";
+  static u8 tau[16] = "expand 16-byte k";
+  u8 *c;
+  int i;
+
+  chacha_SelectKernel ();
+
+  c = (n == 32) ? sigma : tau;
+  for (i = 0; i<4; i++) {
+    ks->s[i] = chacha_load32 (c + 4*i);
+    ks->s[4+i] = chacha_load32 (k + 4*i);
+    ks->s[8+i] = chacha_load32 (k + ((n == 32) ? 16 : 0) + 4*i);
+  }
+  ks->s[12] = ks->s[13] = 0;
+  ks->s[14] = ks->s[15] = 0;
+}
+
+void chacha_SetupNonce (uint64_t nonce, struct chacha_KeySchedule *ks)
+{
+  ks->s[14] = (uint32_t) nonce;
+  ks->s[15] = (uint32_t) (nonce >> 32);
+}
+
+/* generates n keystream blocks, starting with block number ctr */
+
+void chacha_Blocks (const struct chacha_KeySchedule *ks, uint64_t ctr, u8 *b, size_t n)
+{
+  size_t k;
+
+  while (n) {
+    k = chacha_kernel (ks->s, ctr, b, n);
+    if (k < n) k += chacha_blocks_c (ks->s, ctr + k, b + CHACHA_BLOCK*k, 1);
+    ctr += k; b += CHACHA_BLOCK*k; n -= k;
+  }
+}
+
+#ifdef TEST_CHACHA
+#include <stdio.h>
+#include <stdlib.h>
+
+/* RFC 7539, section 2.3.2; its 96-bit nonce and 32-bit counter map onto
+ * our 64-bit counter and nonce words. */
+
+static u8 test_key[32] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+};
+
+static u8 test_block[64] = {
+  0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15, 0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+  0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03, 0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+  0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09, 0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+  0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9, 0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e
+};
+
+int main (int argc, char **argv)
+{
+  struct chacha_KeySchedule ks;
+  static u8 a[64*67], c[64*67];
+  uint64_t ctrs[] = { 0, 1, 0xfffffff0ULL, 0x1fffffffaULL, 0x123456789abcdefULL };
+  size_t i;
+
+  chacha_SetupKey (test_key, 32, &ks);
+  chacha_SetupNonce (0x4a000000ULL, &ks);
+  chacha_Blocks (&ks, 0x0900000000000001ULL, a, 1);
+  if (memcmp (a, test_block, 64)) { printf ("FAIL: test vector\n"); return 1; }
+
+  /* the vector kernel must agree with the plain C one, including around
+   * the 32-bit counter boundary */
+  chacha_SetupKey (test_key, 16, &ks);
+  for (i = 0; i<sizeof (ctrs)/sizeof (*ctrs); i++) {
+    chacha_Blocks (&ks, ctrs[i], a, 67);
+    chacha_blocks_c (ks.s, ctrs[i], c, 67);
+    if (memcmp (a, c, sizeof (a))) {
+      printf ("FAIL: %s kernel, counter %llx\n", chacha_KernelName (), (unsigned long long) ctrs[i]);
+      return 1;
+    }
+  }
+
+  printf ("OK (%s kernel)\n", chacha_KernelName ());
+  return 0;
+}
+#endif
+
+/* vim:set sw=4:set ts=8: */
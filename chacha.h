@@ -0,0 +1,37 @@
+/* wipe
+ *
+ * by Berke Durak
+ *
+ * ChaCha20 keystream generator, with SIMD kernels selected at run-time.
+ *
+ */
+
+#ifndef CHACHA_H
+#define CHACHA_H
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef U32U16U8
+typedef unsigned long u32;
+typedef unsigned short u16;
+typedef unsigned char u8;
+#define U32U16U8
+#endif
+
+#define CHACHA_BLOCK 64
+
+/* the state uses the original layout: 128 bits of constants, 256 bits
+ * of key, a 64-bit block counter (words 12-13) and a 64-bit nonce
+ * (words 14-15).  the counter is not kept here, so that any block of
+ * the stream can be generated independently.
+ */
+
+struct chacha_KeySchedule {
+	uint32_t s[16];
+};
+
+void chacha_SetupKey (u8 *k, int n, struct chacha_KeySchedule *ks);
+void chacha_SetupNonce (uint64_t nonce, struct chacha_KeySchedule *ks);
+void chacha_Blocks (const struct chacha_KeySchedule *ks, uint64_t ctr, u8 *b, size_t n);
+const char *chacha_KernelName (void);
+#endif
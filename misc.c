@@ -27,6 +27,19 @@ void *xmalloc (size_t l)
   return m;
 }
 
+void *xrealloc (void *p, size_t l)
+{
+  void *m;
+
+  m = realloc (p, l);
+  if (!m) {
+    errorf (0, "could not allocate %ld bytes", l);
+    exit (EXIT_FAILURE);
+  }
+
+  return m;
+}
+
 int errorf (unsigned long e, char *fmt, ...)
 {
   va_list arg;
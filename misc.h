@@ -20,6 +20,7 @@ int errorf (unsigned long e, char *fmt, ...);
 void informf (char *fmt, ...);
 char *msprintf (char *fmt, ...);
 void *xmalloc (size_t l);
+void *xrealloc (void *p, size_t l);
 
 #ifdef DEBUG
 void debug_pf (char *fmt, ...);
@@ -51,6 +51,8 @@
 #include "misc.h"
 //#include "rc6.h"
 #include "arcfour.h"
+#include "chacha.h"
+#include "aes.h"
 #include "md5.h"
 #include "random.h"
 
@@ -63,9 +65,36 @@ static int rand_rc6_i;
 u32 (*rand_Get32p) (void);
 void (*rand_Fillp) (u8 *b, int n);
 
-static struct arcfour_KeySchedule rand_arcfour;
-static u32 rand_extra;
-static u32 rand_extra_i;
+/* the sequential generators are per thread: rand_Init () sets up that
+ * of the main thread, rand_InitThread () that of any other thread. */
+
+static u8 rand_key[16];
+static __thread struct arcfour_KeySchedule rand_arcfour;
+static struct chacha_KeySchedule rand_chacha;
+static struct aes_KeySchedule rand_aes;
+
+/* the counter-mode generators (chacha20 and aes) produce their stream
+ * a block at a time; what is left of the last block is kept in buf.
+ * each thread has its own nonce, hence its own copy of the key schedule. */
+
+struct rand_CtrStream {
+  struct chacha_KeySchedule chacha;
+  struct aes_KeySchedule aes;
+  int block;
+  uint64_t ctr;
+  u8 buf[CHACHA_BLOCK];
+  int i;
+};
+
+static __thread struct rand_CtrStream rand_ctr;
+
+/* positional streams are keyed with the seed as well; stream number s
+ * uses nonce s+1, nonce 0 being that of the sequential stream above. */
+
+static int rand_at_algo;
+
+static __thread u32 rand_extra;
+static __thread u32 rand_extra_i;
 
 static void rand_Get128BitsPID (u8 buf[16])
 {
@@ -169,6 +198,115 @@ static u32 rand_Get32_arcfour ()
   return x;
 }
 
+static void rand_Blocks_ctr (struct rand_CtrStream *cs, uint64_t ctr, u8 *b, size_t n)
+{
+  if (rand_at_algo == RANDA_AES) aes_Blocks (&cs->aes, ctr, b, n);
+  else chacha_Blocks (&cs->chacha, ctr, b, n);
+}
+
+static void rand_Fill_ctr (u8 *b, int n)
+{
+  struct rand_CtrStream *cs = &rand_ctr;
+  int m;
+
+  /* use up what is left of the last block first */
+  if (cs->i < cs->block) {
+    m = cs->block - cs->i;
+    if (m > n) m = n;
+    memcpy (b, cs->buf + cs->i, m);
+    cs->i += m; b += m; n -= m;
+  }
+
+  /* whole blocks go straight into the buffer */
+  if (n >= cs->block) {
+    m = n / cs->block;
+    rand_Blocks_ctr (cs, cs->ctr, b, m);
+    cs->ctr += m; b += m * cs->block; n -= m * cs->block;
+  }
+
+  if (n) {
+    rand_Blocks_ctr (cs, cs->ctr ++, cs->buf, 1);
+    memcpy (b, cs->buf, n);
+    cs->i = n;
+  }
+}
+
+static u32 rand_Get32_ctr ()
+{
+  u8 b[4];
+
+  rand_Fill_ctr (b, 4);
+  return (u32) b[0] << 24 | (u32) b[1] << 16 | (u32) b[2] << 8 | (u32) b[3];
+}
+
+static void rand_BlocksAt (uint64_t nonce, uint64_t ctr, u8 *b, size_t n)
+{
+  if (rand_at_algo == RANDA_AES) {
+    struct aes_KeySchedule ks = rand_aes;
+
+    aes_SetupNonce (nonce, &ks);
+    aes_Blocks (&ks, ctr, b, n);
+  } else {
+    struct chacha_KeySchedule ks = rand_chacha;
+
+    chacha_SetupNonce (nonce, &ks);
+    chacha_Blocks (&ks, ctr, b, n);
+  }
+}
+
+/* fills b with bytes offset ... offset+n-1 of the stream of the given
+ * pass.  this only reads the key schedules, so any thread may call it
+ * at any time after rand_Init ().
+ */
+
+void rand_FillAt (uint64_t pass, uint64_t offset, u8 *b, size_t n)
+{
+  int bs = (rand_at_algo == RANDA_AES) ? AES_BLOCK : CHACHA_BLOCK;
+  uint64_t ctr = offset / bs;
+  size_t skip = offset % bs, m;
+  u8 t[CHACHA_BLOCK];
+
+  if (skip && n) {
+    rand_BlocksAt (pass + 1, ctr++, t, 1);
+    m = bs - skip;
+    if (m > n) m = n;
+    memcpy (b, t + skip, m);
+    b += m; n -= m;
+  }
+
+  if (n >= bs) {
+    m = n / bs;
+    rand_BlocksAt (pass + 1, ctr, b, m);
+    ctr += m; b += m * bs; n -= m * bs;
+  }
+
+  if (n) {
+    rand_BlocksAt (pass + 1, ctr, t, 1);
+    memcpy (b, t, n);
+  }
+}
+
+/* true if the bulk random data comes from rand_FillAt () */
+
+int rand_Seekable (void)
+{
+  return o_randalgo == RANDA_CHACHA || o_randalgo == RANDA_AES;
+}
+
+static void rand_InitCtr (uint64_t nonce)
+{
+  rand_ctr.chacha = rand_chacha;
+  rand_ctr.aes = rand_aes;
+  chacha_SetupNonce (nonce, &rand_ctr.chacha);
+  aes_SetupNonce (nonce, &rand_ctr.aes);
+  rand_ctr.block = (rand_at_algo == RANDA_AES) ? AES_BLOCK : CHACHA_BLOCK;
+  rand_ctr.ctr = 0;
+  rand_ctr.i = rand_ctr.block;
+
+  rand_Get32p = rand_Get32_ctr;
+  rand_Fillp = rand_Fill_ctr;
+}
+
 inline static u32 rand_Get32_libc ()
 {
   u32 r;
@@ -252,6 +390,18 @@ u32 rand_Get32 ()
 }
 #endif
 
+static void rand_InitArcfour (u8 key[16])
+{
+  int i;
+
+  arcfour_SetupKey (key, 16, &rand_arcfour);
+
+  /* "give the crank those extra turns after initialisation"
+   * suggestion of Jim Gillogly <jim@mentat.com>
+   */
+  for (i = 0; i<RAND_ARCFOUR_EXTRA; i++) arcfour_GetByte (&rand_arcfour);
+}
+
 void rand_Init ()
 {
   u8 key[16];
@@ -271,6 +421,21 @@ void rand_Init ()
       break;
   }
 
+  rand_InitKey (key);
+}
+
+/* sets up the generators from a given seed: the streams of a run can be
+ * produced again with the key rand_GetKey () gives. */
+
+void rand_InitKey (u8 key[16])
+{
+  memcpy (rand_key, key, sizeof (rand_key));
+
+  /* whatever the algorithm, positional streams need a counter-mode cipher */
+  rand_at_algo = (o_randalgo == RANDA_AES) ? RANDA_AES : RANDA_CHACHA;
+  if (rand_at_algo == RANDA_AES) aes_SetupKey (key, sizeof (rand_key), &rand_aes);
+  else chacha_SetupKey (key, sizeof (rand_key), &rand_chacha);
+
   switch (o_randalgo) {
     case RANDA_LIBC:
       debugf ("using libc random generator");
@@ -299,18 +464,51 @@ void rand_Init ()
 #endif
     case RANDA_ARCFOUR:
       debugf ("using arcfour random generator");
-      arcfour_SetupKey (key, sizeof (key), &rand_arcfour);
-
-      /* "give the crank those extra turns after initialisation"
-       * suggestion of Jim Gillogly <jim@mentat.com>
-       */
-      {
-        int i;
-        for (i = 0; i<RAND_ARCFOUR_EXTRA; i++) arcfour_GetByte (&rand_arcfour);
-      }
+      rand_InitArcfour (key);
       rand_Get32p = rand_Get32_arcfour;
       rand_Fillp = rand_Fill_arcfour;
       break;
+    case RANDA_CHACHA:
+      debugf ("using chacha20 random generator (%s kernel)", chacha_KernelName ());
+      rand_InitCtr (0);
+      break;
+    case RANDA_AES:
+      /* the seed is 128 bits, so is the key */
+      debugf ("using aes-128 counter mode random generator (%s kernel)", aes_KernelName ());
+      rand_InitCtr (0);
+      break;
+  }
+}
+
+void rand_GetKey (u8 key[16])
+{
+  memcpy (key, rand_key, sizeof (rand_key));
+}
+
+/* gives the calling thread a sequential generator of its own, distinct
+ * for each id.  the counter-mode ones take nonces from 2^64-1 downwards,
+ * far away from those of the positional streams; arcfour is keyed with
+ * a hash of the seed and the id.  libc's random () is shared, glibc
+ * serialises it.
+ */
+
+void rand_InitThread (unsigned id)
+{
+  MD5_CTX md5;
+  u8 key[16];
+
+  switch (o_randalgo) {
+    case RANDA_CHACHA:
+    case RANDA_AES:
+      rand_InitCtr (~(uint64_t) id);
+      break;
+    case RANDA_ARCFOUR:
+      MD5Init (&md5);
+      MD5Update (&md5, rand_key, sizeof (rand_key));
+      MD5Update (&md5, (u8 *) &id, sizeof (id));
+      MD5Final (key, &md5);
+      rand_InitArcfour (key);
+      break;
   }
 }
 
@@ -10,6 +10,9 @@
 #ifndef RANDOM_H
 #define RANDOM_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifndef U32U16U8
 typedef unsigned long u32;
 typedef unsigned short u16;
@@ -18,12 +21,18 @@ typedef unsigned char u8;
 #endif
 
 void rand_Init ();
+void rand_InitKey (u8 key[16]);
+void rand_GetKey (u8 key[16]);
+void rand_InitThread (unsigned id);
 #define rand_Get32 rand_Get32p
 #define rand_Fill rand_Fillp
 #if 0
 u32 rand_Get32 ();
 #endif
 
+void rand_FillAt (uint64_t pass, uint64_t offset, u8 *b, size_t n);
+int rand_Seekable (void);
+
 extern u32 (*rand_Get32p) ();
 extern void (*rand_Fill) (u8 *, int);
 
@@ -40,6 +49,8 @@ extern char **environ;
 #define RANDA_LIBC 0
 #define RANDA_RC6 1
 #define RANDA_ARCFOUR 2
+#define RANDA_CHACHA 3
+#define RANDA_AES 4
 
 #define RAND_ARCFOUR_EXTRA 8192
 
@@ -0,0 +1,240 @@
+/* wipe
+ *
+ * by Berke Durak
+ *
+ * Bounded ring of buffers, filled by producer threads and drained in
+ * order by a single consumer.
+ *
+ */
+
+/* The writer loop used to generate a buffer, write it, generate the next
+ * one and so on; random buffers were only refreshed ahead of time when
+ * write () returned EAGAIN, which it never does on regular files or
+ * block devices.  Here producer threads fill the buffers of a job (the
+ * random buffers of one pass) into a ring while the writer only takes
+ * full buffers out of it, in order.
+ *
+ * Producers claim items with a compare-and-swap on a shared counter, so
+ * any number of them may run; the consumer is a single thread.  Nobody
+ * ever takes a lock: the only blocking is sleeping on a futex when the
+ * ring is full (producers) or empty (consumer).
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sched.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "misc.h"
+#include "ring.h"
+
+#define LOAD(p) __atomic_load_n (p, __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n (p, v, __ATOMIC_RELEASE)
+
+/* sleeps as long as *w == v */
+
+static void ring_wait (uint32_t *w, uint32_t v)
+{
+#ifdef __linux__
+  syscall (SYS_futex, w, FUTEX_WAIT_PRIVATE, v, 0, 0, 0);
+#else
+  if (LOAD (w) == v) sched_yield ();
+#endif
+}
+
+static void ring_wake (uint32_t *w)
+{
+#ifdef __linux__
+  syscall (SYS_futex, w, FUTEX_WAKE_PRIVATE, INT_MAX, 0, 0, 0);
+#endif
+}
+
+static void *ring_producer (void *a)
+{
+  struct ring *r = a;
+  struct ring_Slot *sl;
+  uint64_t c, e;
+  uint32_t jobs, s;
+
+  for (;;) {
+    jobs = LOAD (&r->jobs);
+    if (LOAD (&r->stop)) break;
+
+    c = LOAD (&r->claim);
+    e = LOAD (&r->end);
+    if (c >= e) {
+      ring_wait (&r->jobs, jobs);
+      continue;
+    }
+    if (!__atomic_compare_exchange_n (&r->claim, &c, c + 1, 0,
+          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      continue;
+
+    /* item c is ours; the job cannot change before we deliver it */
+    sl = &r->slots[c % r->n_slots];
+    while ((s = LOAD (&sl->seq)) != (uint32_t) c) {
+      if (LOAD (&r->stop)) return 0;
+      ring_wait (&sl->seq, s);
+    }
+
+    r->fill (r->arg, c - r->base, sl->buffer);
+    STORE (&sl->seq, (uint32_t) (c + 1));
+    ring_wake (&sl->seq);
+  }
+
+  return 0;
+}
+
+int ring_Init (struct ring *r, char **buffers, int n, int threads)
+{
+  int i;
+
+  r->n_slots = n;
+  r->slots = xmalloc (n * sizeof (*r->slots));
+  for (i = 0; i<n; i++) {
+    r->slots[i].buffer = buffers[i];
+    r->slots[i].seq = i;
+  }
+  r->claim = r->base = r->end = r->next = 0;
+  r->jobs = 0;
+  r->fill = 0;
+  r->arg = 0;
+  r->stop = 0;
+
+  r->threads = xmalloc (threads * sizeof (*r->threads));
+  for (r->n_threads = 0; r->n_threads < threads; r->n_threads ++) {
+    if (pthread_create (&r->threads[r->n_threads], 0, ring_producer, r)) {
+      ring_Shut (r);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+void ring_Shut (struct ring *r)
+{
+  int i;
+
+  STORE (&r->stop, 1);
+  __atomic_add_fetch (&r->jobs, 1, __ATOMIC_RELEASE);
+  ring_wake (&r->jobs);
+  for (i = 0; i<r->n_slots; i++) ring_wake (&r->slots[i].seq);
+
+  for (i = 0; i<r->n_threads; i++) pthread_join (r->threads[i], 0);
+  free (r->threads);
+  free (r->slots);
+  r->n_threads = 0;
+}
+
+/* ends the current job early: the items nobody claimed yet are taken
+ * away from the producers, and those already claimed are waited for and
+ * dropped.  no item is filled anew, and no producer looks at the fill
+ * argument of the job once it returns.  the consumer must have given
+ * back all the items it took. */
+
+void ring_Cancel (struct ring *r)
+{
+  uint64_t c, item;
+
+  /* claim is moved to end rather than end back to claim: claim never
+   * goes back, so a producer that saw the old end can only fail its
+   * compare-and-swap */
+  c = LOAD (&r->claim);
+  while (c < r->end && !__atomic_compare_exchange_n (&r->claim, &c, r->end, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+  while (r->next < c) {
+    ring_Get (r, &item);
+    ring_Put (r, item);
+  }
+
+  /* the slots of the items never claimed are handed over as if they had
+   * been taken and given back; only the last n_slots of them matter */
+  item = r->end - c > (uint64_t) r->n_slots ? r->end - r->n_slots : c;
+  for (; item < r->end; item ++)
+    STORE (&r->slots[item % r->n_slots].seq, (uint32_t) (item + r->n_slots));
+  r->next = r->end;
+}
+
+/* starts a job of count items.  items of the previous job that were
+ * never taken out of the ring are dropped. */
+
+void ring_Start (struct ring *r, ring_fill_t fill, void *arg, uint64_t count)
+{
+  ring_Cancel (r);
+
+  r->fill = fill;
+  r->arg = arg;
+  r->base = r->end;
+  STORE (&r->end, r->base + count);
+  __atomic_add_fetch (&r->jobs, 1, __ATOMIC_RELEASE);
+  ring_wake (&r->jobs);
+}
+
+/* hands the ring a new set of n buffers.  the last job is cancelled
+ * first; the producers are then idle, having nothing left to claim, and
+ * never look at the slots until the next ring_Start (). */
+
+void ring_SetBuffers (struct ring *r, char **buffers, int n)
+{
+  struct ring_Slot *slots;
+  uint64_t item;
+  int i;
+
+  ring_Cancel (r);
+
+  /* the next item claimed is end */
+  slots = xmalloc (n * sizeof (*slots));
+  for (i = 0; i<n; i++) {
+    item = r->end + i;
+    slots[i].buffer = buffers[i];
+    slots[item % n].seq = (uint32_t) item;
+  }
+  free (r->slots);
+  r->slots = slots;
+  r->n_slots = n;
+}
+
+/* returns the buffer of the next item of the job, waiting for it to be
+ * filled.  it must be given back with ring_Put () once it has been used.
+ */
+
+char *ring_Get (struct ring *r, uint64_t *item)
+{
+  struct ring_Slot *sl;
+  uint64_t c;
+  uint32_t s;
+
+  c = r->next ++;
+  sl = &r->slots[c % r->n_slots];
+  while ((s = LOAD (&sl->seq)) != (uint32_t) (c + 1))
+    ring_wait (&sl->seq, s);
+
+  *item = c;
+  return sl->buffer;
+}
+
+void ring_Put (struct ring *r, uint64_t item)
+{
+  struct ring_Slot *sl = &r->slots[item % r->n_slots];
+
+  STORE (&sl->seq, (uint32_t) (item + r->n_slots));
+  ring_wake (&sl->seq);
+}
+
+/* the slot the next ring_Get () will return.  a consumer giving items
+ * back out of order must not call ring_Get () while it still holds the
+ * item previously in that slot, or it would wait forever. */
+
+int ring_NextSlot (struct ring *r)
+{
+  return r->next % r->n_slots;
+}
+
+/* vim:set sw=4:set ts=8: */
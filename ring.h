@@ -0,0 +1,51 @@
+/* wipe
+ *
+ * by Berke Durak
+ *
+ * Bounded ring of buffers, filled by producer threads and drained in
+ * order by a single consumer.
+ *
+ */
+
+#ifndef RING_H
+#define RING_H
+#include <stdint.h>
+#include <pthread.h>
+
+/* slot k holds item s (s = k mod n_slots) once seq == s + 1; it can
+ * take item s when seq == s.  the consumer hands it over to item
+ * s + n_slots by setting seq to that value.
+ */
+
+struct ring_Slot {
+	char *buffer;
+	uint32_t seq;
+};
+
+/* fills the buffer for the item-th item of the current job */
+typedef void (*ring_fill_t) (void *arg, uint64_t item, char *buffer);
+
+struct ring {
+	int n_slots;
+	struct ring_Slot *slots;
+	uint64_t claim;		/* next item to be filled */
+	uint64_t base;		/* first item of the current job */
+	uint64_t end;		/* end of the current job */
+	uint64_t next;		/* next item to be consumed */
+	uint32_t jobs;		/* bumped whenever a job starts; idle producers sleep on it */
+	ring_fill_t fill;
+	void *arg;
+	int stop;
+	int n_threads;
+	pthread_t *threads;
+};
+
+int ring_Init (struct ring *r, char **buffers, int n, int threads);
+void ring_Shut (struct ring *r);
+void ring_SetBuffers (struct ring *r, char **buffers, int n);
+void ring_Cancel (struct ring *r);
+void ring_Start (struct ring *r, ring_fill_t fill, void *arg, uint64_t count);
+char *ring_Get (struct ring *r, uint64_t *item);
+void ring_Put (struct ring *r, uint64_t item);
+int ring_NextSlot (struct ring *r);
+#endif
@@ -0,0 +1,156 @@
+/* wipe
+ *
+ * by Berke Durak
+ *
+ * Minimal io_uring interface, straight on top of the system calls.
+ *
+ */
+
+/* Only what the write engine needs: one submission and one completion
+ * queue, registered buffers, and waiting for completions.  Using the
+ * system calls directly avoids depending on liburing.
+ */
+
+#ifdef HAVE_IO_URING
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+#define LOAD(p) __atomic_load_n (p, __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n (p, v, __ATOMIC_RELEASE)
+
+int uring_Init (struct uring *u, unsigned entries)
+{
+  struct io_uring_params p;
+  char *sq, *cq;
+
+  memset (&p, 0, sizeof (p));
+  memset (u, 0, sizeof (*u));
+  u->fd = syscall (__NR_io_uring_setup, entries, &p);
+  if (u->fd < 0) return -1;
+
+  u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+  u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (u->cq_ring_size > u->sq_ring_size) u->sq_ring_size = u->cq_ring_size;
+    u->cq_ring_size = u->sq_ring_size;
+  }
+
+  u->sq_ring = mmap (0, u->sq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (u->sq_ring == MAP_FAILED) goto fail;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) u->cq_ring = u->sq_ring;
+  else {
+    u->cq_ring = mmap (0, u->cq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (u->cq_ring == MAP_FAILED) goto fail;
+  }
+
+  u->sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+  u->sqes = mmap (0, u->sqes_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED) goto fail;
+
+  sq = u->sq_ring;
+  u->sq_head = (unsigned *) (sq + p.sq_off.head);
+  u->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+  u->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+  u->sq_array = (unsigned *) (sq + p.sq_off.array);
+
+  cq = u->cq_ring;
+  u->cq_head = (unsigned *) (cq + p.cq_off.head);
+  u->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+  u->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+  return 0;
+
+fail:
+  uring_Shut (u);
+  return -1;
+}
+
+void uring_Shut (struct uring *u)
+{
+  int e = errno;
+
+  if (u->sqes && u->sqes != MAP_FAILED) munmap (u->sqes, u->sqes_size);
+  if (u->cq_ring && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring)
+    munmap (u->cq_ring, u->cq_ring_size);
+  if (u->sq_ring && u->sq_ring != MAP_FAILED) munmap (u->sq_ring, u->sq_ring_size);
+  if (u->fd >= 0) close (u->fd);
+  memset (u, 0, sizeof (*u));
+  u->fd = -1;
+  errno = e;
+}
+
+int uring_RegisterBuffers (struct uring *u, struct iovec *iov, int n)
+{
+  return syscall (__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, iov, n);
+}
+
+int uring_UnregisterBuffers (struct uring *u)
+{
+  return syscall (__NR_io_uring_register, u->fd, IORING_UNREGISTER_BUFFERS, 0, 0);
+}
+
+/* returns a cleared sqe, or 0 if the submission queue is full */
+
+struct io_uring_sqe *uring_GetSqe (struct uring *u)
+{
+  unsigned tail = *u->sq_tail, head = LOAD (u->sq_head);
+  struct io_uring_sqe *sqe;
+
+  if (tail - head > *u->sq_mask) return 0;
+
+  sqe = &u->sqes[tail & *u->sq_mask];
+  memset (sqe, 0, sizeof (*sqe));
+  u->sq_array[tail & *u->sq_mask] = tail & *u->sq_mask;
+  STORE (u->sq_tail, tail + 1);
+  u->to_submit ++;
+  return sqe;
+}
+
+/* submits what has been queued, and waits for wait_nr completions */
+
+int uring_Submit (struct uring *u, unsigned wait_nr)
+{
+  int r;
+
+  do {
+    r = syscall (__NR_io_uring_enter, u->fd, u->to_submit, wait_nr,
+        wait_nr ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+  } while (r < 0 && errno == EINTR);
+
+  if (r < 0) return -1;
+  u->to_submit -= r;
+  return r;
+}
+
+/* waits for the next completion; it must be released with uring_CqeSeen () */
+
+struct io_uring_cqe *uring_WaitCqe (struct uring *u)
+{
+  unsigned head;
+
+  for (;;) {
+    head = *u->cq_head;
+    if (head != LOAD (u->cq_tail)) return &u->cqes[head & *u->cq_mask];
+    if (uring_Submit (u, 1) < 0) return 0;
+  }
+}
+
+void uring_CqeSeen (struct uring *u)
+{
+  STORE (u->cq_head, *u->cq_head + 1);
+}
+
+#endif
+
+/* vim:set sw=4:set ts=8: */
@@ -0,0 +1,36 @@
+/* wipe
+ *
+ * by Berke Durak
+ *
+ * Minimal io_uring interface, straight on top of the system calls.
+ *
+ */
+
+#ifndef URING_H
+#define URING_H
+#ifdef HAVE_IO_URING
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+struct uring {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+	unsigned to_submit;	/* sqes queued since the last uring_Submit () */
+};
+
+int uring_Init (struct uring *u, unsigned entries);
+void uring_Shut (struct uring *u);
+int uring_RegisterBuffers (struct uring *u, struct iovec *iov, int n);
+int uring_UnregisterBuffers (struct uring *u);
+struct io_uring_sqe *uring_GetSqe (struct uring *u);
+int uring_Submit (struct uring *u, unsigned wait_nr);
+struct io_uring_cqe *uring_WaitCqe (struct uring *u);
+void uring_CqeSeen (struct uring *u);
+#endif
+#endif
@@ -0,0 +1 @@
+#define WIPE_GIT "9c69c8403a567f3c03313dc563d2d7299ec04020"
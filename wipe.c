@@ -62,6 +62,10 @@
 
 /*** includes */
 
+#if defined(HAVE_O_DIRECT) || defined(HAVE_SYNC_FILE_RANGE) || defined(HAVE_FALLOCATE) || defined(HAVE_RENAMEAT2) || defined(HAVE_SYNCFS)
+#define _GNU_SOURCE	/* O_DIRECT, sync_file_range (), fallocate (), renameat2 (), syncfs () */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -74,7 +78,7 @@
 #endif
 #endif
 
-#ifdef HAVE_GETOPT
+#if defined(HAVE_GETOPT) || defined(HAVE_GETOPT_LONG)
 #include <getopt.h>
 #endif
 #include <ctype.h>
@@ -83,12 +87,27 @@
 #include <fcntl.h>
 #include <time.h>
 #include <signal.h>
+#include <sched.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <limits.h>
+#ifdef HAVE_HUGE_PAGES
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_FIEMAP
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
 
 #include "random.h"
+#include "ring.h"
+#include "uring.h"
 #include "misc.h"
 #include "version.h"
 
@@ -195,15 +214,23 @@ struct passinfo_s {
 /* Passinfo table ***/
 
 
+/* write engines */
+
+#define ENGINE_SYNC 0	/* write () */
+#define ENGINE_URING 1	/* io_uring, several writes in flight */
+
 /*** errno, num_* statistics, middle_of_line */
 
 extern int errno;
 
-int num_errors = 0;
-int num_files = 0;
-int num_dirs = 0;
-int num_spec = 0;
-int num_symlinks = 0;
+/* per thread; worker threads (-j) add theirs to the main thread's when
+ * they exit */
+
+__thread int num_errors = 0;
+__thread int num_files = 0;
+__thread int num_dirs = 0;
+__thread int num_spec = 0;
+__thread int num_symlinks = 0;
 
 int middle_of_line = 0;
 
@@ -224,7 +251,7 @@ int o_verbose = 0;
 int o_silent = 0;
 char *o_devrandom = DEVRANDOM;
 int o_randseed = RANDS_DEVRANDOM;
-int o_randalgo = RANDA_ARCFOUR;
+int o_randalgo = RANDA_CHACHA;
 int o_randseed_set = 0;
 int o_no_remove = 0;
 int o_dont_wipe_filenames = 0;
@@ -239,18 +266,50 @@ int o_wipe_length_set = 0;
 int o_wipe_exact_size = 0;
 int o_skip_passes = 0;
 int o_pass_order[MAX_PASSES] = { -1 };
+int o_generators = 1;
+int o_engine = ENGINE_SYNC;
+int o_queue_depth = 8;
+int o_direct = 0;
+int o_stripes = 1;
+int o_jobs = 1;
+int o_device_jobs = 1;
+#ifdef HAVE_SYNC_FILE_RANGE
+off_t o_writeback = 8<<20;
+#else
+off_t o_writeback = 0;
+#endif
+off_t o_mem_limit = 0;
+int o_huge_pages = 0;
+int o_offload = 0;
+int o_discard = 0;
+int o_fill_holes = 0;
+int o_elevator = 0;
+int o_walkers = 1;
+int o_group = 0;
+char *o_journal = 0;
+int o_verify = 0;
+double o_verify_sample = 0;
+int o_progress_fd = -1;
+int o_resume = 0;
 
 /* End of Options ***/
 
-static int wipe_filename_and_remove (char *fn);
+static int wipe_filename_and_remove (int dfd, char *fn);
+static void names_flush (void);
+static int names_pending (void);
+struct walk_node;
+static void walk_done (struct walk_node *w, int failed);
 
 /*** do_remove */
 
-int do_remove (char *fn)
+/* fn is relative to the directory dfd, or to the current directory if
+ * dfd is AT_FDCWD; it is never a directory */
+
+int do_remove (int dfd, char *fn)
 {
     if (!o_no_remove) {
-        if (o_dont_wipe_filenames) return remove (fn);
-        else return wipe_filename_and_remove (fn);
+        if (o_dont_wipe_filenames) return unlinkat (dfd, fn, 0);
+        else return wipe_filename_and_remove (dfd, fn);
     } else return 0;
 }
 
@@ -281,6 +340,249 @@ void signal_handler (int i)
 
 /* signal_handler ***/
 
+/*** pass streams */
+
+/* with a counter-mode generator, the data written by random pass i of
+ * the n-th file wiped comes from positional stream PASS_STREAM(n, i), at
+ * the byte offset it is written to.  any region of any pass can thus be
+ * regenerated on its own.
+ */
+
+#define PASS_STREAM(serial, pass) (((uint64_t) (serial) << 32) | (uint64_t) (pass))
+
+/* streams past those of the passes: the pass order of a journaled file,
+ * and the chunks --verify-sample reads back */
+
+#define ORDER_STREAM(serial) PASS_STREAM (serial, MAX_PASSES)
+#define SAMPLE_STREAM(serial) PASS_STREAM (serial, MAX_PASSES + 1)
+
+unsigned long wipe_serial = 0;
+
+/* cleared by the first dothejob () */
+int first_job = 1;
+
+/* pass streams ***/
+
+/*** devices */
+
+/* the disk a target lives on: the device itself for block and character
+ * devices, that of the file system for files, and for a partition the
+ * whole disk it is part of.  the worker pool runs at most
+ * o_device_jobs jobs per disk, and keeps per-disk throughput.
+ */
+
+struct device {
+    dev_t dev;
+    char name[32];
+    int active;			/* jobs running on it (pool lock) */
+    uint64_t bytes;		/* written so far */
+    uint64_t last_bytes;	/* at the last progress report */
+    double first, last;		/* time the first job started, the last ended */
+};
+
+static struct device **devices = 0;
+static int n_devices = 0;
+
+/* device the current thread's job writes to, 0 if not tracked */
+static __thread struct device *current_device = 0;
+
+/* bytes of the current file, for --progress-fd */
+static __thread uint64_t *progress_bytes = 0;
+
+static inline void count_written (off_t n)
+{
+    if (current_device)
+        __atomic_add_fetch (&current_device->bytes, (uint64_t) n, __ATOMIC_RELAXED);
+    if (progress_bytes)
+        __atomic_add_fetch (progress_bytes, (uint64_t) n, __ATOMIC_RELAXED);
+}
+
+#ifdef __linux__
+/* resolves d through /sys/dev/block: partitions have a "partition"
+ * attribute and sit in the directory of their disk. */
+
+static dev_t disk_of (dev_t d, char *name, size_t n)
+{
+    char path[64], real[PATH_MAX], buf[32];
+    unsigned ma, mi;
+    char *sl;
+    FILE *f;
+
+    snprintf (path, sizeof (path), "/sys/dev/block/%u:%u", major (d), minor (d));
+    if (!realpath (path, real)) return d;
+
+    snprintf (path, sizeof (path), "/sys/dev/block/%u:%u/partition", major (d), minor (d));
+    if (!access (path, F_OK) && (sl = strrchr (real, '/'))) {
+        *sl = 0;
+        if (strlen (real) + 5 < sizeof (real)) {
+            strcat (real, "/dev");
+            f = fopen (real, "r");
+            real[strlen (real) - 4] = 0;
+            if (f) {
+                if (fgets (buf, sizeof (buf), f) && sscanf (buf, "%u:%u", &ma, &mi) == 2)
+                    d = makedev (ma, mi);
+                fclose (f);
+            }
+        }
+    }
+
+    sl = strrchr (real, '/');
+    snprintf (name, n, "%s", sl ? sl + 1 : real);
+    return d;
+}
+#endif
+
+/* finds or registers the disk of the file or device st describes */
+
+static struct device *find_device (struct stat *st)
+{
+    struct device *dv;
+    char name[32];
+    dev_t d;
+    int i;
+
+    d = (S_ISBLK(st->st_mode) || S_ISCHR(st->st_mode)) ? st->st_rdev : st->st_dev;
+    snprintf (name, sizeof (name), "%u:%u", major (d), minor (d));
+#ifdef __linux__
+    if (!S_ISCHR(st->st_mode)) d = disk_of (d, name, sizeof (name));
+#endif
+
+    for (i = 0; i<n_devices; i++)
+        if (devices[i]->dev == d) return devices[i];
+
+    if (!(n_devices & (n_devices - 1)))
+        devices = xrealloc (devices, (n_devices ? 2 * n_devices : 1) * sizeof (*devices));
+    dv = xmalloc (sizeof (*dv));
+    memset (dv, 0, sizeof (*dv));
+    dv->dev = d;
+    strcpy (dv->name, name);
+    return devices[n_devices++] = dv;
+}
+
+/* devices ***/
+
+/*** inodes */
+
+/* a file with several hard links is wiped through the first of its
+ * names that comes up; the others are only removed.  an inode is noted
+ * once all the passes have been written through one of its names, and
+ * not before: if that wipe fails, the next name wipes the data again.
+ * the inodes noted are kept in an open addressing hash table, with
+ * linear probing, along with the number of their other names, as
+ * st_nlink was when they were noted; an inode is forgotten once that
+ * many names have come up.  st_nlink is not looked at again: names
+ * removed in batches (see names_flush ()) still count as links until
+ * the batch goes. */
+
+struct inode_key {
+    dev_t dev;
+    ino_t ino;		/* 0 for a free slot */
+    nlink_t left;	/* names still to come up */
+};
+
+static struct {
+    pthread_mutex_t lock;
+    struct inode_key *k;
+    unsigned n, size;	/* size is a power of 2, or 0 */
+} inodes = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+
+static unsigned inode_hash (dev_t dev, ino_t ino)
+{
+    uint64_t h = ((uint64_t) ino ^ ((uint64_t) dev << 32 | (uint64_t) dev >> 32)) * 0x9e3779b97f4a7c15ULL;
+
+    return h >> 32;
+}
+
+/* the slot of (dev, ino), or the free one where it would go */
+
+static unsigned inode_slot (dev_t dev, ino_t ino)
+{
+    unsigned i, m = inodes.size - 1;
+
+    for (i = inode_hash (dev, ino) & m; inodes.k[i].ino; i = (i + 1) & m)
+        if (inodes.k[i].ino == ino && inodes.k[i].dev == dev) break;
+    return i;
+}
+
+static void inode_grow (void)
+{
+    struct inode_key *old = inodes.k;
+    unsigned i, size = inodes.size;
+
+    inodes.size = size ? 2 * size : 256;
+    inodes.k = xmalloc (inodes.size * sizeof (*inodes.k));
+    memset (inodes.k, 0, inodes.size * sizeof (*inodes.k));
+    for (i = 0; i<size; i++)
+        if (old[i].ino) inodes.k[inode_slot (old[i].dev, old[i].ino)] = old[i];
+    free (old);
+}
+
+/* frees slot i, moving back the keys after it that would no longer be
+ * found */
+
+static void inode_remove (unsigned i)
+{
+    unsigned j, h, m = inodes.size - 1;
+
+    inodes.k[i].ino = 0;
+    for (j = (i + 1) & m; inodes.k[j].ino; j = (j + 1) & m) {
+        h = inode_hash (inodes.k[j].dev, inodes.k[j].ino) & m;
+        /* j stays if its home h lies cyclically in (i, j] */
+        if (i <= j ? (i < h && h <= j) : (i < h || h <= j)) continue;
+        inodes.k[i] = inodes.k[j];
+        inodes.k[j].ino = 0;
+        i = j;
+    }
+    __atomic_sub_fetch (&inodes.n, 1, __ATOMIC_RELAXED);
+}
+
+/* returns 1 if the data of st has already been wiped through another
+ * name, counting this one as come up */
+
+static int inode_wiped (struct stat *st)
+{
+    unsigned i;
+    int r = 0;
+
+    if (!__atomic_load_n (&inodes.n, __ATOMIC_RELAXED)) return 0;
+
+    pthread_mutex_lock (&inodes.lock);
+    if (inodes.size) {
+        i = inode_slot (st->st_dev, st->st_ino);
+        if (inodes.k[i].ino) {
+            r = 1;
+            if (!--inodes.k[i].left) inode_remove (i);
+        }
+    }
+    pthread_mutex_unlock (&inodes.lock);
+    return r;
+}
+
+/* notes that all the passes over the data of st are on the disk */
+
+static void inode_add (struct stat *st)
+{
+    unsigned i;
+
+    if (st->st_nlink <= 1 || !st->st_ino) return;
+
+    pthread_mutex_lock (&inodes.lock);
+    if (inodes.size && inodes.k[i = inode_slot (st->st_dev, st->st_ino)].ino) {
+        /* another worker wiped it through another name meanwhile */
+        if (!--inodes.k[i].left) inode_remove (i);
+    } else {
+        if (4 * (inodes.n + 1) > 3 * inodes.size) inode_grow ();
+        i = inode_slot (st->st_dev, st->st_ino);
+        inodes.k[i].dev = st->st_dev;
+        inodes.k[i].ino = st->st_ino;
+        inodes.k[i].left = st->st_nlink - 1;
+        __atomic_add_fetch (&inodes.n, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock (&inodes.lock);
+}
+
+/* inodes ***/
+
 /*** fill_random_from_table */
 
 /* This function is used to create random filenames */
@@ -337,6 +639,70 @@ void fill_pattern (char *b, int n, char *p, int l)
 
 /* fill_pattern ***/
 
+/*** pattern tiles */
+
+/* a periodic pattern is kept in a single tile, written over and over
+ * with vectored writes.  the tile is three pages long, so that the 1- and
+ * 3-byte patterns repeat seamlessly from one copy to the next, and any
+ * copy stays aligned for direct i/o.  as with full-size pattern buffers,
+ * the pattern starts over at the beginning of every buffer-sized write.
+ */
+
+#define TILE_SIZE (3 * 4096)
+
+#ifdef IOV_MAX
+#define TILE_IOVS IOV_MAX
+#else
+#define TILE_IOVS 16
+#endif
+
+/* fills iov with the bytes skip ... skip + size - 1 of the endless
+ * repetition of tile, as far as TILE_IOVS entries go; returns the number
+ * of entries used. */
+
+static int tile_iov (struct iovec *iov, char *tile, off_t skip, off_t size)
+{
+    int n, t;
+
+    for (n = 0; size && n < TILE_IOVS; n++) {
+        t = skip % TILE_SIZE;
+        iov[n].iov_base = tile + t;
+        iov[n].iov_len = (TILE_SIZE - t < size) ? TILE_SIZE - t : size;
+        skip += iov[n].iov_len;
+        size -= iov[n].iov_len;
+    }
+    return n;
+}
+
+/* writes size bytes of the repeated tile at pos; returns what was
+ * written, or -1 if nothing could be */
+
+static ssize_t pwrite_tile (int fd, char *tile, int size, off_t pos)
+{
+    struct iovec iov[TILE_IOVS];
+    ssize_t w, done = 0;
+#ifdef HAVE_PWRITEV
+    int n;
+#endif
+
+    while (done < size) {
+#ifdef HAVE_PWRITEV
+        n = tile_iov (iov, tile, done, size - done);
+        w = pwritev (fd, iov, n, pos + done);
+#else
+        /* only the first piece, up to the end of the tile */
+        tile_iov (iov, tile, done, size - done);
+        w = pwrite (fd, iov[0].iov_base, iov[0].iov_len, pos + done);
+#endif
+        if (w < 0) return done ? done : -1;
+        if (!w) break;
+        done += w;
+    }
+    return done;
+}
+
+/* pattern tiles ***/
+
 /*** pattern buffers and wipe info declarations */
 
 struct wipe_pattern_buffer {
@@ -347,18 +713,41 @@ struct wipe_pattern_buffer {
 
 #define MAX_BUFFERS 30
 #define RANDOM_BUFFERS 16
+#define MAX_STRIPES 64
+#define VERIFY_SLOTS 8
+#define VERIFY_READERS 4
 
 struct wipe_info {
+    struct ring ring;	/* producer threads filling random_buffers */
+    int ring_active;
+#ifdef HAVE_IO_URING
+    struct uring uring;
+    int uring_active;
+    int uring_fixed;	/* random_buffers are registered */
+    struct iovec *uring_iov;	/* TILE_IOVS entries per request */
+#endif
+    int align;		/* alignment of all buffers */
+    int direct_fd;	/* O_DIRECT descriptor of the current file, or -1 */
+    int direct_align;	/* offsets and sizes direct_fd can write at */
     int random_length;
     int n_passes;
     int n_buffers;
     int current_pass;
+    int n_random;	/* random buffers allocated */
+    int random_size;	/* and their size */
     struct wipe_pattern_buffer random_buffers[RANDOM_BUFFERS];
-    struct wipe_pattern_buffer buffers[MAX_BUFFERS];
+    struct wipe_pattern_buffer buffers[MAX_BUFFERS];	/* pattern tiles */
+    char *stripe_buffers[MAX_STRIPES];	/* allocated on first use */
+    struct ring verify_ring;	/* reader threads, for --verify */
+    int verify_active;
+    char *verify_buffers[VERIFY_SLOTS];
+    char *verify_expect[VERIFY_SLOTS];	/* random data chunks should read back as */
     struct wipe_pattern_buffer *passes[MAX_PASSES];
     int p[MAX_PASSES];
 };
 
+static void free_buffer (char *b, size_t size);
+
 /* pattern buffers and wipe info declarations ***/
 
 /*** shut_wipe_info */
@@ -367,8 +756,27 @@ void shut_wipe_info (struct wipe_info *wi)
 {
     int i;
 
-    for (i = 0; i<RANDOM_BUFFERS; free (wi->random_buffers[i++].buffer));
-    for (i = 0; i<wi->n_buffers; free (wi->buffers[i++].buffer));
+    if (wi->ring_active) {
+        ring_Shut (&wi->ring);
+        wi->ring_active = 0;
+    }
+#ifdef HAVE_IO_URING
+    if (wi->uring_active) {
+        uring_Shut (&wi->uring);
+        wi->uring_active = 0;
+    }
+    free (wi->uring_iov);
+    wi->uring_iov = 0;
+#endif
+    for (i = 0; i<wi->n_random; i++) free_buffer (wi->random_buffers[i].buffer, wi->random_size);
+    for (i = 0; i<wi->n_buffers; i++) free_buffer (wi->buffers[i].buffer, TILE_SIZE);
+    for (i = 0; i<MAX_STRIPES; i++) free_buffer (wi->stripe_buffers[i], o_buffer_size);
+    if (wi->verify_active) {
+        ring_Shut (&wi->verify_ring);
+        for (i = 0; i<VERIFY_SLOTS; i++) free_buffer (wi->verify_buffers[i], o_buffer_size);
+        for (i = 0; i<VERIFY_SLOTS; i++) free (wi->verify_expect[i]);
+        wi->verify_active = 0;
+    }
 }
 
 /* shut_wipe_info ***/
@@ -379,7 +787,7 @@ void dirty_all_buffers (struct wipe_info *wi)
 {
     int i;
 
-    for (i = 0; i<RANDOM_BUFFERS; wi->random_buffers[i++].type |= BUFT_USED);
+    for (i = 0; i<wi->n_random; wi->random_buffers[i++].type |= BUFT_USED);
 }
 
 /* dirty_all_buffers ***/
@@ -390,7 +798,7 @@ int revitalize_random_buffers (struct wipe_info *wi)
 {
     int i;
 
-    for (i = 0; i<RANDOM_BUFFERS; i++) {
+    for (i = 0; i<wi->n_random; i++) {
         if (wi->random_buffers[i].type & BUFT_USED) {
             fill_random (wi->random_buffers[i].buffer, wi->random_length);
             wi->random_buffers[i].type &= ~BUFT_USED;
@@ -409,7 +817,7 @@ struct wipe_pattern_buffer *get_random_buffer (struct wipe_info *wi)
 {
     int i;
 
-    for (i = 0; i<RANDOM_BUFFERS; i++) {
+    for (i = 0; i<wi->n_random; i++) {
         if (!(wi->random_buffers[i].type & BUFT_USED)) {
             wi->random_buffers[i].type |= BUFT_USED;
             return &wi->random_buffers[i];
@@ -424,190 +832,787 @@ struct wipe_pattern_buffer *get_random_buffer (struct wipe_info *wi)
 
 /* wipe_pattern_buffer ***/
 
-/*** init_wipe_info */
+/*** extents */
 
-void init_wipe_info (struct wipe_info *wi)
-{
-    int i, j;
+/* the region written by the passes is a list of extents: the whole
+ * region for devices, but only the allocated parts of regular files,
+ * so that the holes of sparse files stay holes. */
 
-    wi->n_passes = o_quick?o_quick_passes:MAX_PASSES;
+struct extent {
+    off_t pos;
+    off_t len;
+    off_t chunk;	/* index of its first chunk in the pass */
+};
 
-    /* allocate buffers for random patterns */
+struct extent_list {
+    struct extent *e;
+    int n, max;
+};
 
-    for (i = 0; i<RANDOM_BUFFERS; i ++) {
-        wi->random_buffers[i].type = BUFT_RANDOM;
-        wi->random_buffers[i].buffer = malloc (o_buffer_size);
-        if (!wi->random_buffers[i].buffer) {
-            fprintf (stderr, "could not allocate buffer [1]");
+/* appends [pos, end) clipped to [lo, hi), merging it with the last
+ * extent when they touch */
+
+static void extent_add (struct extent_list *el, off_t pos, off_t end, off_t lo, off_t hi)
+{
+    struct extent *e;
+
+    if (pos < lo) pos = lo;
+    if (end > hi) end = hi;
+    if (pos >= end) return;
+
+    if (el->n && el->e[el->n - 1].pos + el->e[el->n - 1].len == pos) {
+        el->e[el->n - 1].len += end - pos;
+        return;
+    }
+    if (el->n == el->max) {
+        el->max = el->max ? 2 * el->max : 16;
+        el->e = realloc (el->e, el->max * sizeof (*el->e));
+        if (!el->e) {
+            fprintf (stderr, "out of memory for extents\n");
             exit (EXIT_FAILURE);
         }
     }
+    e = &el->e[el->n ++];
+    e->pos = pos;
+    e->len = end - pos;
+}
 
-    /* allocate buffers for periodic patterns */
+#ifdef HAVE_FIEMAP
+/* FIEMAP gives the extents as allocated, up to the end of their last
+ * block; returns -1 if the file system does not support it */
 
-    if (!o_quick)
-        for (wi->n_buffers = 0, i = 0; i<wi->n_passes; i++) {
-            if (!passinfo[i].type) {
-                wi->passes[i] = 0; /* random pass... */
-            } else {
-                /* look if this pattern has already been allocated */
-                for (j = 0; j<wi->n_buffers; j++) {
-                    if (wi->buffers[i].pat_len == passinfo[i].len &&
-                            !memcmp (wi->buffers[i].buffer, passinfo[i].pat, passinfo[i].len))
-                        break;
-                }
+static int fiemap_extents (struct extent_list *el, int fd, off_t lo, off_t hi)
+{
+    struct {
+        struct fiemap fm;
+        struct fiemap_extent fe[64];
+    } m;
+    struct fiemap_extent *fe;
+    off_t start = lo;
+    unsigned i;
 
-                if (j >= wi->n_buffers) {
-                    /* unfortunately we'll have to allocate a new buffers */
-                    j = wi->n_buffers ++;
-                    wi->buffers[j].type = 1; /* periodic */
-                    wi->buffers[j].buffer = malloc (o_buffer_size);
-                    if (!wi->buffers[j].buffer) {
-                        fprintf (stderr, "could not allocate buffer [2]");
-                        exit (EXIT_FAILURE);
-                    }
-                    wi->buffers[j].pat_len = passinfo[i].len;
+    for (;;) {
+        memset (&m.fm, 0, sizeof (m.fm));
+        m.fm.fm_start = start;
+        m.fm.fm_length = hi - start;
+        m.fm.fm_flags = FIEMAP_FLAG_SYNC;
+        m.fm.fm_extent_count = 64;
+        if (ioctl (fd, FS_IOC_FIEMAP, &m.fm)) return -1;
+        if (!m.fm.fm_mapped_extents) return 0;
+
+        for (i = 0; i<m.fm.fm_mapped_extents; i++) {
+            fe = &m.fe[i];
+            extent_add (el, fe->fe_logical, fe->fe_logical + fe->fe_length, lo, hi);
+            if (fe->fe_flags & FIEMAP_EXTENT_LAST) return 0;
+        }
+        start = fe->fe_logical + fe->fe_length;
+        if (start >= hi) return 0;
+    }
+}
+#endif
 
-                    /* fill in pattern */
-                    fill_pattern (wi->buffers[j].buffer,
-                            o_buffer_size, passinfo[i].pat, passinfo[i].len);
-                }
+#ifdef SEEK_DATA
+/* SEEK_DATA and SEEK_HOLE stop at the end of the file: data reaching it
+ * is taken to run up to hi, as its last block may go beyond */
 
-                wi->passes[i] = &wi->buffers[j];
-            }
-        }
+static int seek_extents (struct extent_list *el, int fd, off_t size, off_t lo, off_t hi)
+{
+    off_t pos, end;
+
+    for (pos = lo; pos < hi && pos < size; pos = end) {
+        pos = lseek (fd, pos, SEEK_DATA);
+        if (pos < 0) return errno == ENXIO ? 0 : -1;
+        end = lseek (fd, pos, SEEK_HOLE);
+        if (end < 0) return -1;
+        extent_add (el, pos, end >= size ? hi : end, lo, hi);
+    }
+    return 0;
 }
+#endif
 
-/* init_wipe_info ***/
+/* the extents of [lo, hi) to write */
 
-#define fnerror(x)  { num_errors++; if(middle_of_line) fputc('\n', stderr); fprintf (stderr, "\r%.32s: " x ": %.32s\n", fn, strerror (errno)); }
-#define fnerrorq(x) { num_errors++; if(middle_of_line) fputc('\n', stderr); fprintf (stderr, "\r%.32s: " x "\n", fn); }
+static void map_extents (struct extent_list *el, int fd, struct stat *st, off_t lo, off_t hi)
+{
+    el->n = 0;
+    if (S_ISREG(st->st_mode) && !o_fill_holes && !o_wipe_length_set) {
+#ifdef HAVE_FIEMAP
+        if (!fiemap_extents (el, fd, lo, hi)) return;
+        el->n = 0;
+#endif
+#ifdef SEEK_DATA
+        if (!seek_extents (el, fd, st->st_size, lo, hi)) return;
+        el->n = 0;
+#endif
+    }
+    extent_add (el, lo, hi, lo, hi);
+}
 
-#define FLUSH_MIDDLE if (middle_of_line) { fputc ('\n', stderr); \
-    middle_of_line = 0; }
+/* extents ***/
 
-    /*** directory_name */
+/*** pass_job */
 
-#if 0
-inline static char *directory_name (char *fn)
+/* a pass over the extents of the region, for generator threads: each
+ * extent is cut into o_buffer_size-aligned chunks, and buffer j covers
+ * the j-th chunk of the pass. */
+
+struct pass_job {
+    uint64_t stream;
+    struct extent *extents;
+    int n_extents;
+    off_t n_buffers;
+    off_t length;	/* of all extents */
+    off_t first;	/* chunk of the first ring item, for resumed passes */
+};
+
+/* numbers the chunks of the extents; returns the size of the largest */
+
+static int pass_job_init (struct pass_job *pj, struct extent_list *el)
 {
-    char *dn;
-    char *sp;
-    int dl;
+    struct extent *e;
+    off_t first, last, size, largest = 0;
+    int i;
 
-    sp = strrchr (fn, '/');
-    if (!sp) return strdup ("");
-    dl = sp - fn + 1 + 1;
-    dn = malloc (dl);
-    if (!dn) return 0;
-    memcpy (dn, fn, dl - 1);
-    dn[dl] = 0;
-    return dn;
+    pj->extents = el->e;
+    pj->n_extents = el->n;
+    pj->n_buffers = pj->length = pj->first = 0;
+    for (i = 0; i<el->n; i++) {
+        e = &el->e[i];
+        e->chunk = pj->n_buffers;
+        pj->length += e->len;
+        first = e->pos >> o_lg2_buffer_size;
+        last = (e->pos + e->len + o_buffer_size - 1) >> o_lg2_buffer_size;
+        pj->n_buffers += last - first;
+
+        if (last - first > 2) size = o_buffer_size;
+        else if (last - first == 1) size = e->len;
+        else {
+            /* first and last chunks */
+            size = o_buffer_size - (e->pos & (o_buffer_size - 1));
+            if (size < e->len - size) size = e->len - size;
+        }
+        if (size > largest) largest = size;
+    }
+    return largest;
 }
-#else
-inline static int directory_name_length (char *fn)
+
+static void pass_job_chunk (struct pass_job *pj, off_t j, off_t *pos, int *size)
 {
-    char *bn;
+    struct extent *e;
+    off_t end, next;
+    int lo = 0, hi = pj->n_extents - 1, m;
+
+    while (lo < hi) {
+        m = (lo + hi + 1) / 2;
+        if (pj->extents[m].chunk <= j) lo = m;
+        else hi = m - 1;
+    }
+    e = &pj->extents[lo];
+    end = e->pos + e->len;
 
-    bn = strrchr (fn, '/');
-    if (!bn) return 0;
-    else return bn - fn + 1;
+    if (j == e->chunk) *pos = e->pos;
+    else *pos = ((e->pos >> o_lg2_buffer_size) + j - e->chunk) << o_lg2_buffer_size;
+    next = ((*pos >> o_lg2_buffer_size) + 1) << o_lg2_buffer_size;
+    *size = (next < end ? next : end) - *pos;
 }
-#endif
-
-/* directory_name ***/
 
-static char valid_filename_chars[64] =
-"0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-.";
+static void pass_job_fill (void *arg, uint64_t j, char *buffer)
+{
+    struct pass_job *pj = arg;
+    off_t pos;
+    int size;
 
-/*** wipe_filename_and_remove */
+    pass_job_chunk (pj, pj->first + j, &pos, &size);
+    rand_FillAt (pj->stream, pos, (u8 *) buffer, size);
+}
 
-/* actually, after renaming a file, the only way to make sure that the
- * name change is physically carried out is to call sync (), which flushes
- * out ALL the disk caches of the system, whereas for
- * reading and writing one can use the O_SYNC bit to get syncrhonous
- * I/O for one file. as sync () is very slow, calling sync () after
- * every rename () makes wipe extremely slow.
- */
+/* the first chunk that does not end before offset */
 
-static int wipe_filename_and_remove (char *fn)
+static off_t pass_job_find (struct pass_job *pj, off_t offset)
 {
-    int i, j, k, l;
-    int r = -1;
-    int fn_l, dn_l;
-    /* char *dn; */
-    char *buf[2];
-    struct stat st;
-    int t_l; /* target length */
-
-    /* dn = directory_name (fn); */
-    fn_l = strlen (fn);
-    dn_l = directory_name_length (fn);
+    off_t lo = 0, hi = pj->n_buffers, m, pos;
+    int size;
+
+    while (lo < hi) {
+        m = lo + (hi - lo) / 2;
+        pass_job_chunk (pj, m, &pos, &size);
+        if (pos + size <= offset) lo = m + 1;
+        else hi = m;
+    }
+    return lo;
+}
 
-    buf[0] = malloc (fn_l + NAME_MAX + 1);
-    buf[1] = malloc (fn_l + NAME_MAX + 1);
+/* pass_job ***/
 
-    r = 0;
+/*** init_uring */
 
-    t_l = fn_l - dn_l; /* first target length */
+#ifdef HAVE_IO_URING
+/* random buffers are registered whenever they change */
 
-    if (buf[0] && buf[1]) {
-        strcpy (buf[0], fn);
-        strcpy (buf[1], fn);
-        for (j = 1, i = 0; i < o_name_max_passes;  j ^= 1, i++) {
-            for (k = o_name_max_tries; k; k--) {
-                l = t_l;
-                fill_random_from_table (buf[j] + dn_l, l,
-                        valid_filename_chars, 0x3f);
-                buf[j][dn_l + l] = 0;
-                if (stat (buf[j], &st)) break;
-            }
+static void register_random_buffers (struct wipe_info *wi)
+{
+    struct iovec iov[RANDOM_BUFFERS];
+    int i;
 
-            if (k) {
-                if (!o_silent) {
-                    fprintf (stderr, "\rRenaming %32.32s -> %32.32s", buf[j^1], buf[j]);
-                    middle_of_line = 1;
-                    fflush (stderr);
-                }
-                if (rename (buf[j^1], buf[j])) {
-                    FLUSH_MIDDLE
-                        fprintf (stderr, "%.32s: could not rename '%s' to '%s': %s (%d)\n",
-                                fn, buf[j^1], buf[j], strerror (errno), errno);
-                    r = -1;
-                    break;
-                }
-                (void) sync ();
-            } else {
-                /* we could not find a target name of desired length, so
-                 * increase target length until we find one. */
-                t_l ++;
-                j ^= 1;
-            }
-        }
-        if (remove (buf[j^1])) r = -1;
+    for (i = 0; i<wi->n_random; i++) {
+        iov[i].iov_base = wi->random_buffers[i].buffer;
+        iov[i].iov_len = wi->random_size;
     }
-    free (buf[0]); free (buf[1]);
-    return r;
+    if (!uring_RegisterBuffers (&wi->uring, iov, wi->n_random)) wi->uring_fixed = 1;
+    else debugf ("could not register buffers: %s", strerror (errno));
 }
 
-/* wipe_filename_and_remove ***/
+static void init_uring (struct wipe_info *wi)
+{
+    wi->uring_active = wi->uring_fixed = 0;
+    wi->uring_iov = 0;
+    if (o_engine != ENGINE_URING) return;
+
+    /* random buffers stay in flight until their write completes, which
+     * only the ring keeps track of */
+    if (!wi->ring_active) {
+        fprintf (stderr, "io_uring engine needs generator threads, using write ()\n");
+        return;
+    }
 
-#include <sys/time.h>
+    if (uring_Init (&wi->uring, o_queue_depth + 1)) {
+        fprintf (stderr, "io_uring unavailable (%s), using write ()\n", strerror (errno));
+        return;
+    }
+    wi->uring_active = 1;
+    register_random_buffers (wi);
 
-static double
-get_time_of_day(void)
-{
-    struct timeval tv;
-    gettimeofday(&tv, 0);
-    return (tv.tv_usec * 1e-6 + tv.tv_sec);
+    /* pattern writes repeat their tile from an iovec array of their own */
+    if (!o_quick) wi->uring_iov = xmalloc (o_queue_depth * TILE_IOVS * sizeof (struct iovec));
 }
+#endif
 
-static double eta_start_time;
+/* init_uring ***/
 
-static void
-eta_begin()
+/*** init_wipe_info */
+
+#ifdef HAVE_IO_URING
+static void init_uring (struct wipe_info *wi);
+#endif
+static void resize_random_buffers (struct wipe_info *wi, int n, int size);
+
+/* buffers are aligned for direct i/o, which wants the buffer address,
+ * the file offset and the length to be multiples of the logical block
+ * size of the device. */
+
+#ifdef HAVE_HUGE_PAGES
+
+/* with --huge-pages, buffers that are a whole number of huge pages are
+ * mapped from the hugetlb pool, or failing that asked to be backed by
+ * transparent huge pages; a pass streaming through them then misses the
+ * TLB once per huge page instead of once per page.  where neither is
+ * available they are ordinary pages, as without the option. */
+
+static size_t huge_page_size (void)
 {
-    eta_start_time = get_time_of_day();
+    static size_t hp = 0;
+    FILE *f;
+    char line[128];
+    unsigned long kb;
+
+    if (hp) return hp;
+    kb = 2048;
+    f = fopen ("/proc/meminfo", "r");
+    if (f) {
+        while (fgets (line, sizeof (line), f))
+            if (sscanf (line, "Hugepagesize: %lu kB", &kb) == 1) break;
+        fclose (f);
+    }
+    hp = (size_t) kb << 10;
+    return hp;
+}
+
+static int huge_buffer (size_t size)
+{
+    return o_huge_pages && !(size % huge_page_size ());
+}
+
+/* madvise () succeeds even when transparent huge pages are turned off */
+
+static int thp_enabled (void)
+{
+    FILE *f;
+    char line[128];
+    int r = 0;
+
+    f = fopen ("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (f) {
+        if (fgets (line, sizeof (line), f)) r = !strstr (line, "[never]");
+        fclose (f);
+    }
+    return r;
+}
+
+/* tells, once, which backing the buffers got */
+
+static void huge_backing (int kind)
+{
+    static const char *names[] = { "hugetlb pages", "transparent huge pages", "ordinary pages" };
+    static int reported = 0;
+
+    if (o_verbose && !(__atomic_fetch_or (&reported, 1 << kind, __ATOMIC_RELAXED) & (1 << kind)))
+        fprintf (stderr, "buffers of %lu bytes and more are backed by %s\n",
+                (unsigned long) huge_page_size (), names[kind]);
+}
+
+static char *alloc_huge (size_t size)
+{
+    size_t hp = huge_page_size ();
+    char *b, *a;
+
+    b = mmap (0, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (b != MAP_FAILED) {
+        huge_backing (0);
+        return b;
+    }
+
+    /* transparent huge pages only back aligned ranges: map a huge page
+     * more than needed and trim it */
+    b = mmap (0, size + hp, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED) return 0;
+    a = (char *) (((uintptr_t) b + hp - 1) & ~(uintptr_t) (hp - 1));
+    if (a > b) munmap (b, a - b);
+    if (b + hp > a) munmap (a + size, b + hp - a);
+
+    huge_backing (thp_enabled () && !madvise (a, size, MADV_HUGEPAGE) ? 1 : 2);
+    return a;
+}
+
+#endif
+
+static char *alloc_buffer (struct wipe_info *wi, size_t size)
+{
+#ifdef HAVE_O_DIRECT
+    void *b;
+#endif
+
+#ifdef HAVE_HUGE_PAGES
+    if (huge_buffer (size)) return alloc_huge (size);
+#endif
+#ifdef HAVE_O_DIRECT
+    if (posix_memalign (&b, wi->align, size)) return 0;
+    return b;
+#else
+    return malloc (size);
+#endif
+}
+
+static void free_buffer (char *b, size_t size)
+{
+#ifdef HAVE_HUGE_PAGES
+    if (huge_buffer (size)) {
+        if (b) munmap (b, size);
+        return;
+    }
+#endif
+    free (b);
+}
+
+void init_wipe_info (struct wipe_info *wi, int align)
+{
+    int i, j;
+
+    wi->n_passes = o_quick?o_quick_passes:MAX_PASSES;
+    wi->align = align;
+    wi->direct_fd = -1;
+    memset (wi->stripe_buffers, 0, sizeof (wi->stripe_buffers));
+    wi->verify_active = 0;
+
+    /* two small random buffers, until the first file tells how much it
+     * needs (see size_buffers ()) */
+
+    wi->ring_active = 0;
+#ifdef HAVE_IO_URING
+    wi->uring_active = wi->uring_fixed = 0;
+#endif
+    wi->n_random = wi->random_size = 0;
+    resize_random_buffers (wi, 2, align);
+
+    /* with a counter-mode generator, random buffers can be filled ahead
+     * of time, in parallel, by producer threads. */
+
+    if (rand_Seekable () && o_generators > 0) {
+        char *b[RANDOM_BUFFERS];
+
+        for (i = 0; i<wi->n_random; i++) b[i] = wi->random_buffers[i].buffer;
+        if (ring_Init (&wi->ring, b, wi->n_random, o_generators))
+            fprintf (stderr, "could not start generator threads, generating inline\n");
+        else wi->ring_active = 1;
+    }
+
+    /* allocate buffers for periodic patterns */
+
+    if (!o_quick)
+        for (wi->n_buffers = 0, i = 0; i<wi->n_passes; i++) {
+            if (!passinfo[i].type) {
+                wi->passes[i] = 0; /* random pass... */
+            } else {
+                /* look if this pattern has already been allocated */
+                for (j = 0; j<wi->n_buffers; j++) {
+                    if (wi->buffers[j].pat_len == passinfo[i].len &&
+                            !memcmp (wi->buffers[j].buffer, passinfo[i].pat, passinfo[i].len))
+                        break;
+                }
+
+                if (j >= wi->n_buffers) {
+                    /* unfortunately we'll have to allocate a new tile */
+                    j = wi->n_buffers ++;
+                    wi->buffers[j].type = 1; /* periodic */
+                    wi->buffers[j].buffer = alloc_buffer (wi, TILE_SIZE);
+                    if (!wi->buffers[j].buffer) {
+                        fprintf (stderr, "could not allocate buffer [2]");
+                        exit (EXIT_FAILURE);
+                    }
+                    wi->buffers[j].pat_len = passinfo[i].len;
+
+                    /* fill in pattern */
+                    fill_pattern (wi->buffers[j].buffer,
+                            TILE_SIZE, passinfo[i].pat, passinfo[i].len);
+                }
+
+                wi->passes[i] = &wi->buffers[j];
+            }
+        }
+
+#ifdef HAVE_IO_URING
+    init_uring (wi);
+#endif
+}
+
+/* init_wipe_info ***/
+
+/*** buffer sizing */
+
+/* random buffers are sized for the file at hand: no larger than its
+ * largest write, and no more of them than can be in use at once, which
+ * is one unless generator threads fill them ahead of time.  with
+ * --mem-limit, each of the o_jobs wipe infos gets an equal share of the
+ * limit, which caps the number of random buffers and of stripes.
+ *
+ * buffers grow as soon as a file needs more, and shrink once they are
+ * over four times what it needs; stripe buffers not used by a file are
+ * given back.
+ */
+
+static void resize_random_buffers (struct wipe_info *wi, int n, int size)
+{
+    char *b[RANDOM_BUFFERS];
+    int i;
+
+#ifdef HAVE_IO_URING
+    if (wi->uring_fixed) {
+        uring_UnregisterBuffers (&wi->uring);
+        wi->uring_fixed = 0;
+    }
+#endif
+    /* producers may still be filling them */
+    if (wi->ring_active) ring_Cancel (&wi->ring);
+    for (i = 0; i<wi->n_random; i++) free_buffer (wi->random_buffers[i].buffer, wi->random_size);
+
+    for (i = 0; i<n; i++) {
+        /* they hold no random data yet */
+        wi->random_buffers[i].type = BUFT_RANDOM | BUFT_USED;
+        wi->random_buffers[i].buffer = b[i] = alloc_buffer (wi, size);
+        if (!b[i]) {
+            fprintf (stderr, "could not allocate buffer [1]");
+            exit (EXIT_FAILURE);
+        }
+    }
+    wi->n_random = n;
+    wi->random_size = size;
+    debugf ("%d random buffers of %d bytes", n, size);
+
+    if (wi->ring_active) ring_SetBuffers (&wi->ring, b, n);
+#ifdef HAVE_IO_URING
+    if (wi->uring_active) register_random_buffers (wi);
+#endif
+}
+
+/* length is the largest write of a file of n_writes writes.  *stripes
+ * is the number of stripes wanted, which may come out lower. */
+
+static void size_buffers (struct wipe_info *wi, int length, off_t n_writes, int *stripes)
+{
+    off_t share = 0, have, want;
+    int n, n_min, size, k;
+
+#ifdef HAVE_IO_URING
+    /* io_uring passes leave stripes idle */
+    if (wi->uring_active) *stripes = 1;
+#endif
+    size = (length + wi->align - 1) / wi->align * wi->align;
+    n_min = wi->ring_active ? 2 : 1;	/* a ring needs two slots */
+    n = wi->ring_active ? RANDOM_BUFFERS : 1;
+    if (n > n_writes) n = n_writes;
+    if (n < n_min) n = n_min;
+
+    if (o_mem_limit) {
+        share = o_mem_limit / o_jobs - (off_t) wi->n_buffers * TILE_SIZE;
+        if (*stripes > 1) {
+            /* striped passes fill one buffer per stripe instead */
+            n = n_min;
+            if (*stripes > (share - n * size) / o_buffer_size)
+                *stripes = (share - n * size) / o_buffer_size;
+            if (*stripes < 2) *stripes = 1;
+            else share -= (off_t) *stripes * o_buffer_size;
+        }
+        if (n > share / size) n = share / size;
+        if (n < n_min) n = n_min;
+    }
+
+    have = (off_t) wi->n_random * wi->random_size;
+    want = (off_t) n * size;
+    if (n > wi->n_random || size > wi->random_size || 4 * want <= have)
+        resize_random_buffers (wi, n, size);
+
+    for (k = *stripes > 1 ? *stripes : 0; k<MAX_STRIPES; k++) {
+        free_buffer (wi->stripe_buffers[k], o_buffer_size);
+        wi->stripe_buffers[k] = 0;
+    }
+}
+
+/* buffer sizing ***/
+
+#define fnerror(x)  { num_errors++; if(middle_of_line) fputc('\n', stderr); fprintf (stderr, "\r%.32s: " x ": %.32s\n", fn, strerror (errno)); }
+#define fnerrorq(x) { num_errors++; if(middle_of_line) fputc('\n', stderr); fprintf (stderr, "\r%.32s: " x "\n", fn); }
+
+#define FLUSH_MIDDLE if (middle_of_line) { fputc ('\n', stderr); \
+    middle_of_line = 0; }
+
+    /*** directory_name */
+
+#if 0
+inline static char *directory_name (char *fn)
+{
+    char *dn;
+    char *sp;
+    int dl;
+
+    sp = strrchr (fn, '/');
+    if (!sp) return strdup ("");
+    dl = sp - fn + 1 + 1;
+    dn = malloc (dl);
+    if (!dn) return 0;
+    memcpy (dn, fn, dl - 1);
+    dn[dl] = 0;
+    return dn;
+}
+#else
+inline static int directory_name_length (char *fn)
+{
+    char *bn;
+
+    bn = strrchr (fn, '/');
+    if (!bn) return 0;
+    else return bn - fn + 1;
+}
+#endif
+
+/* directory_name ***/
+
+static char valid_filename_chars[64] =
+"0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-.";
+
+/*** wipe_filename_and_remove */
+
+/* a name is wiped by renaming the file to random names of the same
+ * length, o_name_max_passes times, before removing it.  each rename has
+ * to reach the disk, which used to take a sync () of the whole system
+ * every time.  now the files of a directory are batched instead: each
+ * pass renames all of them, and a single fsync () of the directory then
+ * makes that pass durable.  renameat2 (RENAME_NOREPLACE) takes a random
+ * name only if it is free, without a stat () probe racing with other
+ * processes. */
+
+#define NAME_BATCH 64
+
+struct name_entry {
+    char *fn;			/* as given, for messages */
+    char name[NAME_MAX + 1];	/* its name in the directory now */
+    int len;			/* of the random names */
+    int failed;
+    struct walk_node *node;	/* its directory, with --walkers */
+};
+
+struct name_batch {
+    int dfd;			/* -1 while the batch is empty */
+    dev_t dev;
+    ino_t ino;
+    int n;
+    struct name_entry e[NAME_BATCH];
+};
+
+/* each thread batches the files it removes */
+static __thread struct name_batch names = { -1 };
+
+/* the directory of the file a worker is wiping, with --walkers; taken
+ * by the batch when its name is queued, and told when it is gone */
+static __thread struct walk_node *names_node = 0;
+
+/* the failure flag of the job being run (see struct job), for files
+ * whose wipe is put off by --group */
+static __thread int *job_failed = 0;
+
+/* renames old to a free random name of len characters, trying up to
+ * o_name_max_tries of them; returns 1 if they were all taken */
+
+static int rename_random (int dfd, char *old, char *new, int len)
+{
+    struct stat st;
+    int k;
+
+    for (k = o_name_max_tries; k; k--) {
+        fill_random_from_table (new, len, valid_filename_chars, 0x3f);
+        new[len] = 0;
+        if (!strcmp (new, ".") || !strcmp (new, "..")) continue;
+#ifdef HAVE_RENAMEAT2
+        if (!renameat2 (dfd, old, dfd, new, RENAME_NOREPLACE)) return 0;
+        if (errno == EEXIST) continue;
+        /* file systems that cannot do RENAME_NOREPLACE */
+        if (errno != EINVAL && errno != ENOSYS) return -1;
+#endif
+        if (!fstatat (dfd, new, &st, AT_SYMLINK_NOFOLLOW)) continue;
+        return renameat (dfd, old, dfd, new) ? -1 : 0;
+    }
+    return 1;
+}
+
+/* renames and removes the files of the batch */
+
+static void names_flush (void)
+{
+    struct name_entry *e;
+    char new[NAME_MAX + 1];
+    char *fn;
+    int i, p, r;
+
+    if (names.dfd < 0) return;
+
+    for (p = 0; p<o_name_max_passes; p++) {
+        for (i = 0; i<names.n; i++) {
+            e = &names.e[i];
+            if (e->failed) continue;
+
+            r = rename_random (names.dfd, e->name, new, e->len);
+            if (r > 0) {
+                /* we could not find a target name of desired length, so
+                 * increase target length until we find one. */
+                if (e->len < NAME_MAX) e->len ++;
+                continue;
+            }
+            if (r < 0) {
+                num_errors ++;
+                FLUSH_MIDDLE
+                fprintf (stderr, "%.32s: could not rename '%s' to '%s': %s (%d)\n",
+                        e->fn, e->name, new, strerror (errno), errno);
+                e->failed = 1;
+                continue;
+            }
+            if (!o_silent) {
+                fprintf (stderr, "\rRenaming %32.32s -> %32.32s", e->name, new);
+                middle_of_line = 1;
+                fflush (stderr);
+            }
+            strcpy (e->name, new);
+        }
+        if (fsync (names.dfd)) {
+            fn = names.e[0].fn;
+            fnerror ("fsync of directory");
+        }
+    }
+
+    for (i = 0; i<names.n; i++) {
+        e = &names.e[i];
+        fn = e->fn;
+        /* from now on, failed means the file is still there */
+        e->failed = unlinkat (names.dfd, e->name, 0) != 0;
+        if (e->failed) fnerror ("remove");
+        free (e->fn);
+    }
+    (void) fsync (names.dfd);
+
+    close (names.dfd);
+    names.dfd = -1;
+
+    /* their directories may go now */
+    for (i = 0; i<names.n; i++)
+        if (names.e[i].node) walk_done (names.e[i].node, names.e[i].failed);
+    names.n = 0;
+}
+
+static int names_pending (void)
+{
+    return names.dfd >= 0;
+}
+
+static int wipe_filename_and_remove (int dfd, char *fn)
+{
+    struct name_entry *e;
+    struct stat st;
+    char *dn;
+    int dn_l;
+
+    dn_l = directory_name_length (fn);
+    if (strlen (fn + dn_l) > NAME_MAX) { errno = ENAMETOOLONG; return -1; }
+
+    if (dn_l) {
+        dn = xmalloc (dn_l + 1);
+        memcpy (dn, fn, dn_l);
+        dn[dn_l] = 0;
+        dfd = openat (dfd, dn, O_RDONLY | O_DIRECTORY);
+        free (dn);
+    } else dfd = openat (dfd, ".", O_RDONLY | O_DIRECTORY);
+    if (dfd < 0) return -1;
+    if (fstat (dfd, &st)) {
+        close (dfd);
+        return -1;
+    }
+
+    if (names_pending () && (st.st_dev != names.dev || st.st_ino != names.ino ||
+                names.n == NAME_BATCH))
+        names_flush ();
+    if (names_pending ()) close (dfd);
+    else {
+        names.dfd = dfd;
+        names.dev = st.st_dev;
+        names.ino = st.st_ino;
+    }
+
+    e = &names.e[names.n ++];
+    e->fn = xmalloc (strlen (fn) + 1);
+    strcpy (e->fn, fn);
+    strcpy (e->name, fn + dn_l);
+    e->len = strlen (e->name);
+    e->failed = 0;
+    e->node = names_node;
+    names_node = 0;
+    return 0;
+}
+
+/* wipe_filename_and_remove ***/
+
+#include <sys/time.h>
+
+static double
+get_time_of_day(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return (tv.tv_usec * 1e-6 + tv.tv_sec);
+}
+
+static double eta_start_time;
+
+static void
+eta_begin()
+{
+    eta_start_time = get_time_of_day();
 }
 
 static void
@@ -691,571 +1696,3140 @@ backspace(char *dst, const char *src)
     *dst = '\0';
 }
 
-void wipe_continuation_message(void *arg)
+/*** progress stream */
+
+/* with --progress-fd=n, a thread writes a line of JSON to descriptor n
+ * every second for each file being wiped:
+ *
+ *   {"file":"f","pass":3,"passes":35,"bytes":1048576,"total":36700160,
+ *    "mbps":41.9,"avg_mbps":40.2,"eta":0.9}
+ *
+ * bytes and total count the writes of all the passes still to do,
+ * mbps is over the last second and avg_mbps since the file was started;
+ * eta is in seconds, null until something has been written.  a last
+ * line sums up the run once it is over.  each thread wiping files has a
+ * slot, whose byte count the writers only bump with relaxed atomics;
+ * everything else is read under a lock taken once per file. */
+
+struct progress_slot {
+    struct progress_slot *next;
+    char *fn;		/* of the file being wiped, 0 if none */
+    int pass, n_passes;
+    uint64_t bytes, total;
+    double start;
+    unsigned seq;	/* bumped for every file */
+    /* the progress thread's own */
+    unsigned last_seq;
+    uint64_t last_bytes;
+    double last;
+};
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int stop;
+    struct progress_slot *slots;
+    uint64_t bytes;	/* of the files done with */
+    double start;
+} progress = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+static __thread struct progress_slot *progress_slot = 0;
+
+/* appends the first max bytes of s to b as a JSON string */
+
+static int json_string (char *b, char *s, int max)
 {
-    int i;
-    struct wipe_info *wi = arg;
+    int n = 0;
 
-    fprintf (stderr, "*** If you want to resume wiping while preserving the pass order, use these options:\n");
-    fprintf (stderr, "***   -X %d -x ", wi->current_pass);
-    for (i = 0; i<wi->n_passes; i++) {
-        if (i > 0) fprintf (stderr, ",");
-        fprintf (stderr, "%d", wi->p[i]);
+    b[n++] = '"';
+    for (; *s && max--; s++) {
+        if (*s == '"' || *s == '\\') n += sprintf (b + n, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20) n += sprintf (b + n, "\\u%04x", (unsigned char) *s);
+        else b[n++] = *s;
     }
-    fprintf(stderr, "\n");
-    fflush (stderr);
+    b[n++] = '"';
+    return n;
 }
 
-/*** dothejob -- nonrecursive wiping of a single file or device */
+static void progress_write (char *line, int n)
+{
+    ssize_t w;
+
+    while (n > 0) {
+        w = write (o_progress_fd, line, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return;
+        line += w;
+        n -= w;
+    }
+}
 
-/* determine parameters of region to be wiped
- *    file descriptor,
- *    offset,
- *    size.
- *
- *
- * compute the number of entire buffers needed to cover the region,
- * and the size of the remaining area.
- *
- * if pattern buffers have not been computed, compute them.
+/* called with progress.lock held */
+
+static void progress_emit (void)
+{
+    char line[6 * PATH_MAX + 256];
+    struct progress_slot *s;
+    uint64_t b;
+    double now, avg;
+    int n;
+
+    now = get_time_of_day ();
+    for (s = progress.slots; s; s = s->next) {
+        if (!s->fn) continue;
+        b = __atomic_load_n (&s->bytes, __ATOMIC_RELAXED);
+        if (s->last_seq != s->seq) {
+            s->last_seq = s->seq;
+            s->last_bytes = 0;
+            s->last = s->start;
+        }
+        avg = now > s->start ? b / (now - s->start) : 0;
+
+        n = sprintf (line, "{\"file\":");
+        n += json_string (line + n, s->fn, PATH_MAX);
+        n += sprintf (line + n, ",\"pass\":%d,\"passes\":%d,\"bytes\":%llu,\"total\":%llu,"
+                "\"mbps\":%.1f,\"avg_mbps\":%.1f,\"eta\":",
+                __atomic_load_n (&s->pass, __ATOMIC_RELAXED), s->n_passes,
+                (unsigned long long) b, (unsigned long long) s->total,
+                now > s->last ? (b - s->last_bytes) / (now - s->last) / 1e6 : 0.0,
+                avg / 1e6);
+        if (avg > 0) n += sprintf (line + n, "%.1f}\n", b < s->total ? (s->total - b) / avg : 0.0);
+        else n += sprintf (line + n, "null}\n");
+        progress_write (line, n);
+
+        s->last_bytes = b;
+        s->last = now;
+    }
+}
+
+static void *progress_thread (void *a)
+{
+    struct timespec ts;
+
+    pthread_mutex_lock (&progress.lock);
+    while (!progress.stop) {
+        clock_gettime (CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        if (pthread_cond_timedwait (&progress.wake, &progress.lock, &ts) == ETIMEDOUT)
+            progress_emit ();
+    }
+    pthread_mutex_unlock (&progress.lock);
+    return 0;
+}
+
+static void progress_start (void)
+{
+    if (o_progress_fd < 0) return;
+    progress.start = get_time_of_day ();
+    if (pthread_create (&progress.thread, 0, progress_thread, 0)) {
+        fprintf (stderr, "could not start the progress thread\n");
+        exit (EXIT_FAILURE);
+    }
+}
+
+/* ends the stream with the totals of the run */
+
+static void progress_stop (void)
+{
+    char line[256];
+    double t;
+
+    if (o_progress_fd < 0) return;
+    pthread_mutex_lock (&progress.lock);
+    progress.stop = 1;
+    pthread_cond_signal (&progress.wake);
+    pthread_mutex_unlock (&progress.lock);
+    pthread_join (progress.thread, 0);
+
+    t = get_time_of_day () - progress.start;
+    progress_write (line, sprintf (line, "{\"done\":true,\"files\":%d,\"errors\":%d,"
+                "\"bytes\":%llu,\"seconds\":%.1f,\"avg_mbps\":%.1f}\n",
+                num_files, num_errors, (unsigned long long) progress.bytes, t,
+                t > 0 ? progress.bytes / t / 1e6 : 0.0));
+}
+
+/* the current thread starts wiping fn: total bytes, in n_passes passes
+ * from pass */
+
+static void progress_begin (char *fn, int pass, int n_passes, uint64_t total)
+{
+    struct progress_slot *s = progress_slot;
+
+    if (o_progress_fd < 0) return;
+    pthread_mutex_lock (&progress.lock);
+    if (!s) {
+        s = progress_slot = xmalloc (sizeof (*s));
+        memset (s, 0, sizeof (*s));
+        s->next = progress.slots;
+        progress.slots = s;
+    }
+    free (s->fn);
+    s->fn = xmalloc (strlen (fn) + 1);
+    strcpy (s->fn, fn);
+    s->pass = pass;
+    s->n_passes = n_passes;
+    s->bytes = 0;
+    s->total = total;
+    s->start = get_time_of_day ();
+    s->seq ++;
+    pthread_mutex_unlock (&progress.lock);
+    progress_bytes = &s->bytes;
+}
+
+static void progress_pass (int pass)
+{
+    if (progress_slot) __atomic_store_n (&progress_slot->pass, pass, __ATOMIC_RELAXED);
+}
+
+static void progress_end (void)
+{
+    struct progress_slot *s = progress_slot;
+
+    if (!s || !s->fn) return;
+    pthread_mutex_lock (&progress.lock);
+    free (s->fn);
+    s->fn = 0;
+    progress.bytes += s->bytes;
+    pthread_mutex_unlock (&progress.lock);
+    progress_bytes = 0;
+}
+
+/* progress stream ***/
+
+/*** show_progress */
+
+/* block progress indicator: shown once a pass has been running for a
+ * few seconds, then refreshed every second. */
+
+struct progress {
+    int bpi;	/* block progress indicator enabled ? */
+    time_t lt;
+    int skip;	/* passes skipped with -X */
+};
+
+static void show_progress (struct progress *pr, int i, off_t j, off_t buffers_to_wipe, int n_passes)
+{
+    time_t t;
+
+    t = time (0);
+    if ((pr->bpi && (t-pr->lt)) || ((t-pr->lt>2) && j<(buffers_to_wipe>>1))) {
+        char buf1[30];
+        char buf1_bs[sizeof (buf1)];
+        char buf2[18];
+        char buf2_bs[sizeof(buf2)];
+        snprintf(buf1, sizeof(buf1),
+                "[%8ld / %8ld]", (long) j, (long)buffers_to_wipe);
+        backspace(buf1_bs, buf1);
+        eta_progress(buf2, sizeof(buf2),
+            ((double) (i - pr->skip) + ((double)j / buffers_to_wipe)) / (n_passes - pr->skip));
+        if (buf2[0])
+            pad(buf2, sizeof(buf2));
+        backspace(buf2_bs, buf2);
+        fprintf(stderr, "%s%s%s%s", buf1, buf2, buf2_bs,
+            buf1_bs);
+        fflush (stderr);
+        pr->lt = t;
+        pr->bpi = 1;
+    }
+}
+
+/* show_progress ***/
+
+void wipe_continuation_message(void *arg)
+{
+    int i;
+    struct wipe_info *wi = arg;
+
+    if (o_journal) {
+        fprintf (stderr, "*** If you want to resume wiping, run wipe again with --journal=%s --resume\n", o_journal);
+        fflush (stderr);
+        return;
+    }
+    fprintf (stderr, "*** If you want to resume wiping while preserving the pass order, use these options:\n");
+    fprintf (stderr, "***   -X %d -x ", wi->current_pass);
+    for (i = 0; i<wi->n_passes; i++) {
+        if (i > 0) fprintf (stderr, ",");
+        fprintf (stderr, "%d", wi->p[i]);
+    }
+    fprintf(stderr, "\n");
+    fflush (stderr);
+}
+
+/*** direct i/o */
+
+/* with --direct, writes that are aligned on the logical block size go
+ * through a second, O_DIRECT descriptor and bypass the page cache; the
+ * unaligned head and tail that -o and -l can produce go through the
+ * ordinary descriptor. */
+
+#ifdef HAVE_O_DIRECT
+static int get_direct_align (int fd, struct stat *st)
+{
+    int lbs;
+
+    if (S_ISBLK(st->st_mode)) {
+#ifdef BLKSSZGET
+        if (!ioctl (fd, BLKSSZGET, &lbs) && lbs > 0) return lbs;
+#endif
+        return 512;
+    }
+    if (S_ISREG(st->st_mode)) return st->st_blksize;
+    return 0;	/* character devices */
+}
+
+static void open_direct (struct wipe_info *wi, int dfd, char *fn, struct stat *st, int align)
+{
+    wi->direct_fd = -1;
+    if (!align || align > wi->align) return;
+
+    wi->direct_fd = openat (dfd, fn, O_WRONLY | O_DIRECT);
+    if (wi->direct_fd < 0) {
+        if (!o_silent)
+            fprintf (stderr, "\r%.32s: no direct i/o (%s), using the page cache\n",
+                    fn, strerror (errno));
+        return;
+    }
+    wi->direct_align = align;
+}
+#endif
+
+static void close_direct (struct wipe_info *wi)
+{
+    if (wi->direct_fd >= 0) {
+        close (wi->direct_fd);
+        wi->direct_fd = -1;
+    }
+}
+
+static inline int write_fd (struct wipe_info *wi, int fd, off_t pos, int size)
+{
+    if (wi->direct_fd >= 0 && !(pos % wi->direct_align) && !(size % wi->direct_align))
+        return wi->direct_fd;
+    return fd;
+}
+
+/* direct i/o ***/
+
+/*** offload */
+
+/* with --offload, passes of all zeroes are left to the kernel, which can
+ * have the device produce the zeroes itself instead of moving them over
+ * the bus: BLKZEROOUT on block devices, fallocate (FALLOC_FL_ZERO_RANGE)
+ * on files.  both return 0 once the range reads back as zeroes, or -1
+ * with errno set when the pass has to be written as usual. */
+
+static int zero_pass (struct wipe_pattern_buffer *wpb)
+{
+    return wpb && wpb->pat_len == 1 && !wpb->buffer[0];
+}
+
+static int offload_zero_range (int fd, struct stat *st, off_t pos, off_t len)
+{
+#ifdef BLKZEROOUT
+    if (S_ISBLK(st->st_mode)) {
+        uint64_t range[2];
+
+        range[0] = pos;
+        range[1] = len;
+        return ioctl (fd, BLKZEROOUT, range) ? -1 : 0;
+    }
+#endif
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_ZERO_RANGE)
+    if (S_ISREG(st->st_mode))
+        return fallocate (fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, pos, len) ? -1 : 0;
+#endif
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
+/* with --discard, the region is handed back to thin-provisioned storage
+ * once the last pass is on disk: BLKSECDISCARD, or BLKDISCARD where
+ * secure discard is not supported, on block devices, and
+ * FALLOC_FL_PUNCH_HOLE on files that are kept (-k).  there is nothing
+ * to fall back to; the passes have been written anyway. */
+
+static int offload_discard_range (int fd, struct stat *st, off_t pos, off_t len)
+{
+#ifdef BLKDISCARD
+    if (S_ISBLK(st->st_mode)) {
+        uint64_t range[2];
+
+        range[0] = pos;
+        range[1] = len;
+#ifdef BLKSECDISCARD
+        if (!ioctl (fd, BLKSECDISCARD, range)) return 0;
+#endif
+        return ioctl (fd, BLKDISCARD, range) ? -1 : 0;
+    }
+#endif
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+    if (S_ISREG(st->st_mode))
+        return fallocate (fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, pos, len) ? -1 : 0;
+#endif
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
+static int offload_zero (int fd, struct stat *st, struct pass_job *pj)
+{
+    int i;
+
+    for (i = 0; i<pj->n_extents; i++)
+        if (offload_zero_range (fd, st, pj->extents[i].pos, pj->extents[i].len)) return -1;
+    return 0;
+}
+
+static int offload_discard (int fd, struct stat *st, struct pass_job *pj)
+{
+    int i;
+
+    for (i = 0; i<pj->n_extents; i++)
+        if (offload_discard_range (fd, st, pj->extents[i].pos, pj->extents[i].len)) return -1;
+    return 0;
+}
+
+/* offload ***/
+
+/*** writeback window */
+
+/* instead of opening files with O_SYNC, which makes every write wait for
+ * the disk, data is pushed out in windows of o_writeback bytes: once a
+ * window has been written, sync_file_range () starts its writeback and
+ * waits for that of the previous one, so at most two windows are ever
+ * dirty.  the pass ends with fdatasync (), which also flushes the disk's
+ * cache.  with o_writeback 0, O_SYNC is used as before.
+ */
+
+struct writeback {
+    int fd;
+    off_t prev, prev_end;	/* the window being written back */
+    off_t start;	/* start of the window being written */
+    off_t pos;		/* end of what has been written */
+};
+
+static void writeback_init (struct writeback *wb, int fd, off_t pos)
+{
+    wb->fd = fd;
+    wb->prev = wb->prev_end = wb->start = wb->pos = pos;
+}
+
+#ifdef HAVE_SYNC_FILE_RANGE
+static void writeback_push (struct writeback *wb)
+{
+    if (wb->pos > wb->start)
+        (void) sync_file_range (wb->fd, wb->start, wb->pos - wb->start,
+                SYNC_FILE_RANGE_WRITE);
+    if (wb->prev_end > wb->prev)
+        (void) sync_file_range (wb->fd, wb->prev, wb->prev_end - wb->prev,
+                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                SYNC_FILE_RANGE_WAIT_AFTER);
+    wb->prev = wb->start;
+    wb->prev_end = wb->start = wb->pos;
+}
+#endif
+
+/* n bytes have been written at pos, which is wb->pos unless a hole
+ * was skipped, which ends the window; errors are left for the
+ * fdatasync () at the end of the pass */
+
+static void writeback_written (struct writeback *wb, off_t pos, off_t n)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+    if (o_writeback && pos != wb->pos) writeback_push (wb);
+#endif
+    if (pos != wb->pos) wb->start = pos;
+    wb->pos = pos + n;
+#ifdef HAVE_SYNC_FILE_RANGE
+    if (o_writeback && wb->pos - wb->start >= o_writeback) writeback_push (wb);
+#endif
+}
+
+/* puts the pass on stable storage */
+
+static int sync_pass (int fd)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+    if (o_writeback) return fdatasync (fd);
+#endif
+    return fsync (fd);
+}
+
+/* writeback window ***/
+
+/*** verify */
+
+/* with --verify, a pass is read back once it is on the disk and compared
+ * with what was written: the pattern tile, or the random stream of the
+ * pass generated again.  reads go through O_DIRECT, or when the file
+ * cannot be opened so, after dropping its pages from the cache.  the
+ * chunks are read and compared by reader threads, the producers of a
+ * ring of their own, so that generating the data to compare with
+ * overlaps the reads and runs in parallel; the caller only collects the
+ * verdicts in order.  chunks are read aligned: they never cross a
+ * multiple of the buffer size, so the blocks they lie in fit in a
+ * buffer.
  *
- * compute one pattern buffer (either fill it or fetch it).
- * send an asynchronous write.
+ * --verify-sample=P only reads back the last pass, and only about P% of
+ * its chunks: the chunks are cut into strata of 100/P, and one chunk of
+ * each, drawn from the sample stream of the file, is read.  the first
+ * and the last chunk, where the region may start and end unaligned, are
+ * always among them.  a disk that does not know the seed cannot tell
+ * which chunks will be looked at.
+ */
+
+#define VERIFY_LAST 1
+#define VERIFY_ALL 2
+
+struct verify_job {
+    int fd;
+    int align;		/* of the offsets and sizes fd reads at */
+    struct pass_job *pj;
+    off_t every;	/* one chunk in every is read */
+    off_t n_items;
+    uint64_t sample;	/* stream the chunks are drawn from */
+    struct wipe_pattern_buffer *wpb;	/* or 0 for the random stream */
+    uint64_t stream;
+    char **expect;
+    int stop;		/* a difference was found, the rest is not read */
+    int ok[VERIFY_SLOTS];	/* verdict on chunk j, at j % VERIFY_SLOTS */
+};
+
+/* whether b holds the first size bytes of the endless repetition of
+ * tile */
+
+static int tile_matches (char *b, char *tile, int size)
+{
+    for (; size > 0; b += TILE_SIZE, size -= TILE_SIZE)
+        if (memcmp (b, tile, size < TILE_SIZE ? size : TILE_SIZE)) return 0;
+    return 1;
+}
+
+/* the chunk of the k-th item */
+
+static off_t verify_chunk (struct verify_job *vj, uint64_t k)
+{
+    uint64_t h;
+
+    if (vj->every == 1) return k;
+    if (!k) return 0;
+    if (k == vj->n_items - 1) return vj->pj->n_buffers - 1;
+    rand_FillAt (vj->sample, k * sizeof (h), (u8 *) &h, sizeof (h));
+    return k * vj->every + h % vj->every;
+}
+
+/* at most VERIFY_SLOTS items are in the ring at a time, so k %
+ * VERIFY_SLOTS tells them apart */
+
+static void verify_read (void *arg, uint64_t k, char *buffer)
+{
+    struct verify_job *vj = arg;
+    char *expect = vj->expect[k % VERIFY_SLOTS];
+    off_t pos, start;
+    ssize_t r, done = 0;
+    int size, len, skip, ok = 0;
+
+    if (__atomic_load_n (&vj->stop, __ATOMIC_RELAXED)) goto out;
+
+    pass_job_chunk (vj->pj, verify_chunk (vj, k), &pos, &size);
+    skip = pos % vj->align;
+    start = pos - skip;
+    len = skip + size;
+    len += (vj->align - len % vj->align) % vj->align;
+
+    while (done < len) {
+        r = pread (vj->fd, buffer + done, len - done, start + done);
+        if (r < 0) goto out;
+        if (!r) break;
+        done += r;
+    }
+    if (done < skip + size) goto out;
+
+    if (vj->wpb) ok = tile_matches (buffer + skip, vj->wpb->buffer, size);
+    else {
+        rand_FillAt (vj->stream, pos, (u8 *) expect, size);
+        ok = !memcmp (buffer + skip, expect, size);
+    }
+out:
+    vj->ok[k % VERIFY_SLOTS] = ok;
+}
+
+static int verify_wanted (int pass, int n_passes)
+{
+    return o_verify == VERIFY_ALL ||
+        ((o_verify == VERIFY_LAST || o_verify_sample) && pass == n_passes - 1);
+}
+
+/* reads back pass of the regions of pj in fn, written with wpb, or with
+ * the random stream of the pass if wpb is 0 */
+
+static int verify_pass (struct wipe_info *wi, int dfd, char *fn, struct stat *st,
+        struct pass_job *pj, int pass, unsigned long serial, struct wipe_pattern_buffer *wpb)
+{
+    struct verify_job vj;
+    uint64_t item;
+    off_t k, pos, bad = -1;
+    int i, size;
+
+    if (!wi->verify_active) {
+        for (i = 0; i<VERIFY_SLOTS; i++) {
+            wi->verify_buffers[i] = alloc_buffer (wi, o_buffer_size);
+            if (!wi->verify_buffers[i]) {
+                fprintf (stderr, "could not allocate buffer [3]");
+                exit (EXIT_FAILURE);
+            }
+        }
+        for (i = 0; i<VERIFY_SLOTS; i++) wi->verify_expect[i] = xmalloc (o_buffer_size);
+        if (ring_Init (&wi->verify_ring, wi->verify_buffers, VERIFY_SLOTS, VERIFY_READERS)) {
+            fprintf (stderr, "could not start reader threads\n");
+            exit (EXIT_FAILURE);
+        }
+        wi->verify_active = 1;
+    }
+
+    if (!o_silent) {
+        fprintf (stderr, "\rVerifying %.32s, pass %-2d   ", fn, pass);
+        middle_of_line = 1;
+    }
+
+    vj.pj = pj;
+    vj.every = 1;
+    vj.n_items = pj->n_buffers;
+    if (o_verify_sample && pj->n_buffers > 2 && o_verify_sample * 2 <= 100) {
+        vj.every = 100 / o_verify_sample;
+        vj.n_items = (pj->n_buffers + vj.every - 1) / vj.every;
+        if (vj.n_items < 2) vj.n_items = 2;
+        vj.sample = SAMPLE_STREAM (serial);
+    }
+    vj.wpb = wpb;
+    vj.stream = PASS_STREAM (serial, pass);
+    vj.expect = wi->verify_expect;
+    vj.stop = 0;
+    vj.align = 1;
+    vj.fd = -1;
+#ifdef HAVE_O_DIRECT
+    vj.fd = openat (dfd, fn, O_RDONLY | O_DIRECT);
+    if (vj.fd >= 0) {
+        vj.align = get_direct_align (vj.fd, st);
+        if (vj.align <= 0 || vj.align > wi->align || vj.align > o_buffer_size) {
+            close (vj.fd);
+            vj.fd = -1;
+        }
+    }
+#endif
+    if (vj.fd < 0) {
+        vj.align = 1;
+        vj.fd = openat (dfd, fn, O_RDONLY);
+        if (vj.fd < 0) { fnerror ("could not open for verification"); return -1; }
+#ifdef POSIX_FADV_DONTNEED
+        /* the pass was synced: its pages are clean and can go */
+        (void) posix_fadvise (vj.fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    }
+
+    ring_Start (&wi->verify_ring, verify_read, &vj, vj.n_items);
+    for (k = 0; k<vj.n_items; k++) {
+        ring_Get (&wi->verify_ring, &item);
+        if (bad < 0 && !vj.ok[k % VERIFY_SLOTS]) {
+            pass_job_chunk (pj, verify_chunk (&vj, k), &pos, &size);
+            bad = pos;
+            __atomic_store_n (&vj.stop, 1, __ATOMIC_RELAXED);
+        }
+        ring_Put (&wi->verify_ring, item);
+    }
+    close (vj.fd);
+
+    if (bad >= 0) {
+        num_errors++;
+        FLUSH_MIDDLE;
+        fprintf (stderr, "\r%.32s: pass %d does not read back as written, at offset %lld\n",
+                fn, pass, (long long) bad);
+        return -1;
+    }
+
+    /* were a fraction f of the chunks bad, all n_items would read back
+     * right with a probability of (1 - f)^n_items < exp (-f n_items):
+     * under 1% once f >= ln 100 / n_items */
+    if (vj.every > 1 && !o_silent) {
+        FLUSH_MIDDLE;
+        fprintf (stderr, "\r%.32s: %lld of %lld chunks read back as written: "
+                "less than %.3g%% of them are bad, with 99%% confidence\n",
+                fn, (long long) vj.n_items, (long long) pj->n_buffers,
+                100 * 4.6052 / vj.n_items);
+    }
+    return 0;
+}
+
+/* verify ***/
+
+/*** uring_pass */
+
+#ifdef HAVE_IO_URING
+
+/* one pass through io_uring: up to o_queue_depth writes are kept in
+ * flight, and the pass ends with an fsync that drains them all.
+ * random data comes from the ring (wpb == 0), patterns from the tile of
+ * wpb.  a write that completes short is queued again for the rest.
+ */
+
+struct uring_req {
+    uint64_t item;	/* ring item of a random write */
+    char *buf;
+    off_t pos;
+    int size;
+    int done;		/* bytes written so far */
+    struct iovec *iov;	/* TILE_IOVS entries, for pattern writes */
+};
+
+static int uring_buffer_index (struct wipe_info *wi, char *b)
+{
+    int i;
+
+    for (i = 0; i<wi->n_random; i++)
+        if (wi->random_buffers[i].buffer == b) return i;
+    return -1;
+}
+
+/* the uring has o_queue_depth + 1 entries: one per write in flight and
+ * one for the fsync, so there is always a free sqe.  were there none,
+ * what is queued is submitted to make room.  returns 0 if
+ * io_uring_enter () failed. */
+
+static struct io_uring_sqe *uring_sqe (struct uring *u)
+{
+    struct io_uring_sqe *sqe;
+
+    while (!(sqe = uring_GetSqe (u)))
+        if (uring_Submit (u, 0) <= 0) return 0;
+    return sqe;
+}
+
+/* queues what is left to write of request r; returns -1 if io_uring_enter
+ * () failed */
+
+static int uring_queue (struct wipe_info *wi, int fd, struct uring_req *rq, int r,
+        struct wipe_pattern_buffer *wpb)
+{
+    struct io_uring_sqe *sqe;
+    off_t pos = rq->pos + rq->done;
+    int size = rq->size - rq->done;
+
+    if (!(sqe = uring_sqe (&wi->uring))) return -1;
+    sqe->fd = write_fd (wi, fd, pos, size);
+    sqe->off = pos;
+    sqe->user_data = r;
+    if (wpb) {
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->addr = (unsigned long) rq->iov;
+        sqe->len = tile_iov (rq->iov, wpb->buffer, rq->done, size);
+    } else {
+        sqe->addr = (unsigned long) (rq->buf + rq->done);
+        sqe->len = size;
+        if (wi->uring_fixed) {
+            sqe->opcode = IORING_OP_WRITE_FIXED;
+            sqe->buf_index = uring_buffer_index (wi, rq->buf);
+        } else sqe->opcode = IORING_OP_WRITE;
+    }
+    return 0;
+}
+
+/* io_uring_enter () failed.  the kernel may still be reading the buffers
+ * of the writes in flight, so their completions are waited for before
+ * the random buffers go back to the ring.  the uring is then shut, and
+ * later files of this thread are written with pwrite ().  should the
+ * completions not come either, the random buffers are left to the
+ * kernel: the ring is shut and they are forgotten, so that they are
+ * neither filled nor freed any more. */
+
+static void uring_abandon (struct wipe_info *wi, char *fn, struct uring_req *req,
+        int *free_req, int n_free, struct wipe_pattern_buffer *wpb)
+{
+    struct io_uring_cqe *cqe;
+    char in_flight[RANDOM_BUFFERS];
+    int r, n = o_queue_depth - n_free, tries = 0;
+
+    memset (in_flight, 1, sizeof (in_flight));
+    for (r = 0; r<n_free; r++) in_flight[free_req[r]] = 0;
+
+    while (n) {
+        if (!(cqe = uring_WaitCqe (&wi->uring))) {
+            /* those may go away */
+            if ((errno == EAGAIN || errno == EBUSY) && tries++ < 1000) {
+                usleep (1000);
+                continue;
+            }
+            break;
+        }
+        r = cqe->user_data;
+        uring_CqeSeen (&wi->uring);
+        if (r < 0 || r >= o_queue_depth || !in_flight[r]) continue;
+        in_flight[r] = 0;
+        n --;
+        if (!wpb) ring_Put (&wi->ring, req[r].item);
+    }
+
+    if (n && !wpb) {
+        ring_Shut (&wi->ring);
+        wi->ring_active = 0;
+        wi->n_random = 0;
+    }
+    uring_Shut (&wi->uring);
+    wi->uring_active = wi->uring_fixed = 0;
+    if (!o_silent) {
+        FLUSH_MIDDLE;
+        fprintf (stderr, "\r%.32s: giving up io_uring, writing with pwrite ()\n", fn);
+    }
+}
+
+static int uring_pass (struct wipe_info *wi, struct progress *pr, int fd, char *fn,
+        int pass, struct pass_job *pj, struct wipe_pattern_buffer *wpb)
+{
+    struct uring *u = &wi->uring;
+    struct uring_req req[RANDOM_BUFFERS];
+    int free_req[RANDOM_BUFFERS], n_free;
+    char busy[RANDOM_BUFFERS];	/* ring slots whose write is in flight */
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    off_t j;
+    int inflight = 0, err = 0;
+    int r, res;
+
+    for (n_free = 0; n_free < o_queue_depth; n_free ++) {
+        free_req[n_free] = n_free;
+        if (wi->uring_iov) req[n_free].iov = wi->uring_iov + n_free * TILE_IOVS;
+    }
+    memset (busy, 0, sizeof (busy));
+
+    for (j = 0; (j < pj->n_buffers && !err) || inflight; ) {
+        /* writes complete out of order: the slot of the next random
+         * buffer may still be held by an older write */
+        while (j < pj->n_buffers && !err && inflight < o_queue_depth &&
+                (wpb || !busy[ring_NextSlot (&wi->ring)])) {
+            r = free_req[--n_free];
+            pass_job_chunk (pj, j, &req[r].pos, &req[r].size);
+            req[r].done = 0;
+            if (wpb) req[r].buf = wpb->buffer;
+            else {
+                busy[ring_NextSlot (&wi->ring)] = 1;
+                req[r].buf = ring_Get (&wi->ring, &req[r].item);
+            }
+            if (uring_queue (wi, fd, &req[r], r, wpb)) {
+                /* not in flight */
+                if (!wpb) ring_Put (&wi->ring, req[r].item);
+                free_req[n_free++] = r;
+                goto fail;
+            }
+
+            inflight ++; j ++;
+        }
+
+        /* nothing will complete any more: give up on the file */
+        if (uring_Submit (u, 0) < 0 || !(cqe = uring_WaitCqe (u))) goto fail;
+
+        r = cqe->user_data;
+        res = cqe->res;
+        uring_CqeSeen (u);
+        if (res < 0) {
+            errno = -res;
+            if (!err) fnerror ("write error");
+            err = 1;
+        } else if (!res) {
+            if (!err) fnerror ("short write");
+            err = 1;
+        } else {
+            count_written (res);
+            req[r].done += res;
+            if (req[r].done < req[r].size && !err) {
+                if (!uring_queue (wi, fd, &req[r], r, wpb)) continue;
+                if (!wpb) ring_Put (&wi->ring, req[r].item);
+                free_req[n_free++] = r;
+                goto fail;
+            }
+        }
+
+        if (!wpb) {
+            busy[req[r].item % wi->ring.n_slots] = 0;
+            ring_Put (&wi->ring, req[r].item);
+        }
+        free_req[n_free++] = r;
+        inflight --;
+
+        if (!o_silent && o_progress_fd < 0)
+            show_progress (pr, pass, j - inflight, pj->n_buffers, wi->n_passes);
+    }
+    if (err) return -1;
+
+    /* the pass is over once everything written so far is on disk */
+    if (!(sqe = uring_sqe (u))) goto fail;
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_IO_DRAIN;
+    if (o_writeback) sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    if (uring_Submit (u, 1) < 0 || !(cqe = uring_WaitCqe (u))) goto fail;
+    r = cqe->res;
+    uring_CqeSeen (u);
+    if (r < 0) {
+        errno = -r;
+        fnerror ("fsync error [2]");
+        return -1;
+    }
+
+    return 0;
+
+fail:
+    fnerror ("io_uring_enter");
+    uring_abandon (wi, fn, req, free_req, n_free, wpb);
+    return -1;
+}
+#endif
+
+/* uring_pass ***/
+
+/*** striped passes */
+
+/* with --stripes=K, the region is cut into K contiguous stripes that K
+ * threads write at the same time with pwrite (); the calling thread
+ * writes the first one.  the threads meet at a barrier before and after
+ * each pass, and the pass ends with a single fsync (), so that passes
+ * still follow one another on the medium.  random data comes from the
+ * positional streams, each thread filling its own buffer.
+ */
+
+struct stripe_set;
+
+struct stripe {
+    struct stripe_set *ss;
+    int k;
+    char *buffer;
+};
+
+struct stripe_set {
+    struct wipe_info *wi;
+    struct pass_job *pj;
+    int fd;
+    int n;			/* number of stripes */
+    struct device *device;
+    uint64_t *progress_bytes;
+    struct stripe stripes[MAX_STRIPES];
+    pthread_t threads[MAX_STRIPES];
+    pthread_barrier_t start, end;
+
+    /* current pass */
+    struct wipe_pattern_buffer *wpb;	/* 0 for a random pass */
+    struct progress *pr;
+    int pass;
+    off_t done;			/* buffers written so far */
+    int err;			/* errno of the first failed write, -1 for a short write */
+    int quit;
+};
+
+static void stripe_write (struct stripe *st)
+{
+    struct stripe_set *ss = st->ss;
+    struct pass_job *pj = ss->pj;
+    off_t j, j1, pos, done;
+    ssize_t wr;
+    int size, e;
+    char *buf;
+    struct writeback wb;
+
+    j = pj->n_buffers * st->k / ss->n;
+    j1 = pj->n_buffers * (st->k + 1) / ss->n;
+    if (j < j1) {
+        pass_job_chunk (pj, j, &pos, &size);
+        writeback_init (&wb, ss->fd, pos);
+    }
+
+    for (; j < j1 && !__atomic_load_n (&ss->err, __ATOMIC_RELAXED); j ++) {
+        pass_job_chunk (pj, j, &pos, &size);
+        if (ss->wpb) buf = ss->wpb->buffer;
+        else {
+            buf = st->buffer;
+            rand_FillAt (pj->stream, pos, (u8 *) buf, size);
+        }
+
+        if (ss->wpb) wr = pwrite_tile (write_fd (ss->wi, ss->fd, pos, size), buf, size, pos);
+        else wr = pwrite (write_fd (ss->wi, ss->fd, pos, size), buf, size, pos);
+#ifndef HAVE_OSYNC
+        if (wr == size && !o_writeback && fsync (ss->fd)) wr = -1;
+#endif
+        if (wr != size) {
+            e = 0;
+            __atomic_compare_exchange_n (&ss->err, &e, (wr < 0 && errno) ? errno : -1,
+                    0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            break;
+        }
+
+        writeback_written (&wb, pos, size);
+        count_written (size);
+        done = __atomic_add_fetch (&ss->done, 1, __ATOMIC_RELAXED);
+        if (!st->k && !o_silent && o_progress_fd < 0)
+            show_progress (ss->pr, ss->pass, done, pj->n_buffers, ss->wi->n_passes);
+    }
+}
+
+static void *stripe_thread (void *a)
+{
+    struct stripe *st = a;
+    struct stripe_set *ss = st->ss;
+
+    current_device = ss->device;
+    progress_bytes = ss->progress_bytes;
+    for (;;) {
+        pthread_barrier_wait (&ss->start);
+        if (ss->quit) break;
+        stripe_write (st);
+        pthread_barrier_wait (&ss->end);
+    }
+    return 0;
+}
+
+/* sets up n stripes over the region of pj */
+
+static void stripes_start (struct stripe_set *ss, struct wipe_info *wi,
+        int fd, struct pass_job *pj, int n)
+{
+    int k;
+
+    ss->wi = wi;
+    ss->pj = pj;
+    ss->fd = fd;
+    ss->n = n;
+    ss->device = current_device;
+    ss->progress_bytes = progress_bytes;
+    ss->quit = 0;
+
+    for (k = 0; k<n; k++) {
+        if (!wi->stripe_buffers[k]) {
+            wi->stripe_buffers[k] = alloc_buffer (wi, o_buffer_size);
+            if (!wi->stripe_buffers[k]) {
+                fprintf (stderr, "could not allocate buffer [3]");
+                exit (EXIT_FAILURE);
+            }
+        }
+        ss->stripes[k].ss = ss;
+        ss->stripes[k].k = k;
+        ss->stripes[k].buffer = wi->stripe_buffers[k];
+    }
+
+    pthread_barrier_init (&ss->start, 0, n);
+    pthread_barrier_init (&ss->end, 0, n);
+    for (k = 1; k<n; k++) {
+        if (pthread_create (&ss->threads[k], 0, stripe_thread, &ss->stripes[k])) {
+            fprintf (stderr, "could not start stripe threads");
+            exit (EXIT_FAILURE);
+        }
+    }
+}
+
+static void stripes_stop (struct stripe_set *ss)
+{
+    int k;
+
+    ss->quit = 1;
+    pthread_barrier_wait (&ss->start);
+    for (k = 1; k<ss->n; k++) pthread_join (ss->threads[k], 0);
+    pthread_barrier_destroy (&ss->start);
+    pthread_barrier_destroy (&ss->end);
+}
+
+static int stripes_pass (struct stripe_set *ss, struct progress *pr, char *fn,
+        int pass, struct wipe_pattern_buffer *wpb)
+{
+    ss->wpb = wpb;
+    ss->pr = pr;
+    ss->pass = pass;
+    ss->done = 0;
+    ss->err = 0;
+
+    pthread_barrier_wait (&ss->start);
+    stripe_write (&ss->stripes[0]);
+    pthread_barrier_wait (&ss->end);
+
+    if (ss->err) {
+        if (ss->err < 0) fnerrorq ("short write")
+        else {
+            errno = ss->err;
+            fnerror ("write error");
+        }
+        return -1;
+    }
+
+    if (sync_pass (ss->fd)) {
+        fnerror ("fsync error [2]");
+        return -1;
+    }
+    return 0;
+}
+
+/* striped passes ***/
+
+/*** dothejob -- nonrecursive wiping of a single file or device */
+
+/* determine parameters of region to be wiped
+ *    file descriptor,
+ *    offset,
+ *    size.
+ *
+ *
+ * compute the number of entire buffers needed to cover the region,
+ * and the size of the remaining area.
+ *
+ * if pattern buffers have not been computed, compute them.
+ *
+ * compute one pattern buffer (either fill it or fetch it).
+ * send an asynchronous write.
+ *
+ * select
+ */
+
+#define max(x,y) ((x>y)?x:y)
+
+/* the end of a job: a regular file has its size wiped before fd, if it
+ * has been opened, is closed; then the file is removed */
+
+static int job_finish (int dfd, char *fn, int fd, struct stat *st, int relinked)
+{
+    if (fd >= 0) {
+        if (S_ISREG(st->st_mode) && !o_dont_wipe_filesizes) {
+            off_t s;
+            u32 x;
+
+            s = st->st_size;
+            x = rand_Get32 ();
+
+            while (s) {
+                s >>= 1;
+                x >>= 1;
+                if (x & 1) {
+                    if (ftruncate (fd, s)) {
+                        fnerror ("truncate");
+                        close (fd);
+                        return -1;
+                    }
+                }
+            }
+        }
+        close (fd);
+    }
+
+    /* if this is a symbolic link, then remove the target of the link */
+    /* of course, we have a race condition here. */
+    /* no user should be able to control a link you're wiping... */
+    if (o_dereference_symlinks) {
+        struct stat st2;
+
+        if (fstatat (dfd, fn, &st2, AT_SYMLINK_NOFOLLOW)) {
+            fnerror("lstat error");
+            return -1;
+        }
+        if (S_ISLNK(st2.st_mode)) {
+            int m;
+            char buf[NAME_MAX+1];
+
+            num_symlinks ++;
+            m = readlinkat (dfd, fn, buf, NAME_MAX);
+            if (m < 0) {
+                fnerror ("readlink");
+                return -1;
+            }
+            buf[m] = 0;
+            if (do_remove (dfd, buf)) { fnerror("remove"); return -1; }
+        }
+    }
+
+    /* remove link or file */
+    if (do_remove (dfd, fn)) { fnerror("remove"); return -1; }
+
+    if (!o_silent) {
+        fprintf (stderr, "\r                                                                              \r");
+        middle_of_line = 0;
+    }
+
+    if (S_ISLNK(st->st_mode)) {
+        num_symlinks ++;
+        if (o_verbose) {
+            printf ("Not following symbolic link %.32s\n", fn);
+            middle_of_line = 0;
+        }
+    } else {
+        num_files ++;
+        if (o_verbose) {
+            if (relinked)
+                printf ("File %.32s removed, already wiped through another link\n", fn);
+            else printf ("File %.32s (%ld bytes) wiped\n", fn, (long) st->st_size);
+            middle_of_line = 0;
+        }
+    }
+    return 0;
+}
+
+/*** journal */
+
+/* with --journal=file, the progress of the wipe is appended to file, a
+ * record per line:
+ *
+ *   K <key>                          the seed of the run, in hex
+ *   F <dev> <ino> <serial> <p0,p1,...> <name>
+ *                                    a file is started, with the serial
+ *                                    of its random streams and its pass
+ *                                    order
+ *   P <serial> <pass> <offset>       that pass of the file is on the
+ *                                    disk up to offset
+ *   D <serial>                       all its passes are done
+ *
+ * random data only depends on the seed, the serial and the offset, so
+ * --resume keys the generators again and takes every file up from its
+ * last P record, writing just what an uninterrupted run would have.
+ * progress is recorded at most once a second per file, after an
+ * fdatasync () of the file, and the journal is made durable along with
+ * it.  the seed is in the journal: it should
+ * not live on the disk being wiped, and should be wiped afterwards. */
+
+struct journal_entry {
+    dev_t dev;
+    ino_t ino;
+    unsigned long serial;
+    int n_passes;
+    int p[MAX_PASSES];
+    int pass;
+    off_t offset;
+    int done;
+};
+
+static struct {
+    int fd;
+    struct journal_entry *e;	/* read back by --resume, by inode */
+    int n;
+} journal = { -1, 0, 0 };
+
+/* what identifies a file across runs; device nodes may be created
+ * again, the devices themselves stay */
+
+static void journal_key (struct stat *st, dev_t *dev, ino_t *ino)
+{
+    *dev = S_ISBLK(st->st_mode) ? st->st_rdev : st->st_dev;
+    *ino = S_ISBLK(st->st_mode) ? 0 : st->st_ino;
+}
+
+static int journal_compare (const void *a, const void *b)
+{
+    const struct journal_entry *x = a, *y = b;
+
+    if (x->dev != y->dev) return x->dev < y->dev ? -1 : 1;
+    if (x->ino != y->ino) return x->ino < y->ino ? -1 : 1;
+    return x->serial < y->serial ? -1 : x->serial > y->serial;
+}
+
+static void journal_write (char *fmt, ...)
+{
+    char buf[NAME_MAX + 4 * MAX_PASSES + 128];
+    va_list va;
+    int n;
+
+    va_start (va, fmt);
+    n = vsnprintf (buf, sizeof (buf), fmt, va);
+    va_end (va);
+    if (n >= sizeof (buf)) n = sizeof (buf) - 1;
+    /* one write () per record keeps those of several workers apart */
+    if (write (journal.fd, buf, n) != n && !o_silent)
+        fprintf (stderr, "\rcould not write to the journal: %s\n", strerror (errno));
+}
+
+/* the entry of the last run for st, if any */
+
+static struct journal_entry *journal_find (struct stat *st)
+{
+    struct journal_entry k, *e;
+    int lo = 0, hi = journal.n, m;
+
+    journal_key (st, &k.dev, &k.ino);
+    k.serial = ~0UL;
+    /* past the last entry of the inode: it may have been started more
+     * than once */
+    while (lo < hi) {
+        m = (lo + hi) / 2;
+        if (journal_compare (&journal.e[m], &k) < 0) lo = m + 1;
+        else hi = m;
+    }
+    if (!lo) return 0;
+    e = &journal.e[lo - 1];
+    return e->dev == k.dev && e->ino == k.ino ? e : 0;
+}
+
+static void journal_start (struct stat *st, unsigned long serial, int *p, int n_passes, char *fn)
+{
+    char list[4 * MAX_PASSES], name[NAME_MAX + 1], *s;
+    dev_t dev;
+    ino_t ino;
+    int i, l = 0;
+
+    journal_key (st, &dev, &ino);
+    for (i = 0; i<n_passes; i++) l += sprintf (list + l, i ? ",%d" : "%d", p[i]);
+    /* the name is only there for whoever reads the journal */
+    snprintf (name, sizeof (name), "%s", fn);
+    for (s = name; *s; s++) if (*s == '\n') *s = '?';
+    journal_write ("F %llu %llu %lu %s %s\n", (unsigned long long) dev,
+            (unsigned long long) ino, serial, list, name);
+}
+
+/* everything before offset in the pass has been written to fd, or has
+ * reached the disk if fd is -1; last is the time of the previous record
+ * for the file.  a window that was written back may still sit in the
+ * disk's cache, and without its metadata: the offset is only recorded
+ * once an fdatasync () has covered it. */
+
+static void journal_progress (unsigned long serial, int pass, int fd, off_t offset, time_t *last)
+{
+    time_t t = time (0);
+
+    if (t == *last) return;
+    *last = t;
+    if (fd >= 0 && fdatasync (fd)) return;
+    journal_write ("P %lu %d %lld\n", serial, pass, (long long) offset);
+    (void) fdatasync (journal.fd);
+}
+
+static void journal_done (unsigned long serial)
+{
+    journal_write ("D %lu\n", serial);
+}
+
+/* the entry of serial, looked for from the end: records mostly follow
+ * the start of their file closely */
+
+static struct journal_entry *journal_serial (unsigned long serial)
+{
+    int i;
+
+    for (i = journal.n - 1; i >= 0; i--)
+        if (journal.e[i].serial == serial) return &journal.e[i];
+    return 0;
+}
+
+/* reads back the journal of an interrupted run */
+
+static int journal_read (char *fn)
+{
+    char line[NAME_MAX + 4 * MAX_PASSES + 128], *s;
+    struct journal_entry *e, k;
+    unsigned long long dev, ino;
+    unsigned long serial;
+    long long offset;
+    unsigned int h;
+    long v;
+    int i, n, pass, max = 0, keyed = 0;
+    u8 key[16];
+    FILE *f;
+
+    f = fopen (fn, "r");
+    if (!f) { fnerror ("could not open the journal"); return -1; }
+
+    while (fgets (line, sizeof (line), f)) {
+        /* the last line may have been cut short */
+        if (!strchr (line, '\n')) break;
+
+        switch (line[0]) {
+            case 'K':
+                for (i = 0; i<16; i++)
+                    if (sscanf (line + 2 + 2 * i, "%2x", &h) == 1) key[i] = h;
+                    else break;
+                keyed = i == 16;
+                break;
+            case 'F':
+                if (sscanf (line, "F %llu %llu %lu %n", &dev, &ino, &serial, &n) != 3) break;
+
+                /* the pass order, checked: it indexes the passes */
+                memset (&k, 0, sizeof (k));
+                for (s = line + n; k.n_passes < MAX_PASSES; s++) {
+                    v = strtol (s, &s, 10);
+                    if (v < 0 || v >= MAX_PASSES) break;
+                    k.p[k.n_passes ++] = v;
+                    if (*s != ',') break;
+                }
+                if (!k.n_passes || (*s != ' ' && *s != '\n')) break;
+
+                if (journal.n == max) {
+                    max = max ? 2 * max : 256;
+                    journal.e = realloc (journal.e, max * sizeof (*journal.e));
+                    if (!journal.e) { fnerrorq ("out of memory for the journal"); fclose (f); return -1; }
+                }
+                e = &journal.e[journal.n ++];
+                *e = k;
+                e->dev = dev;
+                e->ino = ino;
+                e->serial = serial;
+                if (serial >= wipe_serial) wipe_serial = serial + 1;
+                break;
+            case 'P':
+                if (sscanf (line, "P %lu %d %lld", &serial, &pass, &offset) != 3) break;
+                if ((e = journal_serial (serial)) &&
+                        pass >= 0 && pass <= e->n_passes && offset >= 0) {
+                    e->pass = pass;
+                    e->offset = offset;
+                }
+                break;
+            case 'D':
+                if (sscanf (line, "D %lu", &serial) != 1) break;
+                if ((e = journal_serial (serial))) e->done = 1;
+                break;
+        }
+    }
+    fclose (f);
+
+    if (!keyed) { fnerrorq ("no seed in the journal"); return -1; }
+    rand_InitKey (key);
+    qsort (journal.e, journal.n, sizeof (*journal.e), journal_compare);
+    return 0;
+}
+
+/* starts the journal fn, or carries on with it if resume is set */
+
+static int journal_open (char *fn, int resume)
+{
+    u8 key[16];
+    int i;
+
+    if (resume && journal_read (fn)) return -1;
+
+    journal.fd = open (fn, O_WRONLY | O_APPEND | O_CREAT | (resume ? 0 : O_TRUNC), 0600);
+    if (journal.fd < 0) { fnerror ("could not open the journal"); return -1; }
+
+    if (!resume) {
+        rand_GetKey (key);
+        journal_write ("K ");
+        for (i = 0; i<16; i++) journal_write ("%02x", key[i]);
+        journal_write ("\n");
+        if (fdatasync (journal.fd)) { fnerror ("could not write to the journal"); return -1; }
+    }
+    return 0;
+}
+
+/* journal ***/
+
+/*** small file groups */
+
+/* with --group=n, a regular file that fits in one buffer is not wiped
+ * by itself: up to n of them are gathered, opened without O_SYNC, and
+ * each pass is written to all of them before a single syncfs () per
+ * file system makes it durable.  every file still gets its passes in
+ * order, but a file of a few KB no longer costs one flush per pass. */
+
+#define MAX_GROUP 1024
+
+struct group_file {
+    char *fn;
+    int dfd;		/* a descriptor of its own, or AT_FDCWD */
+    int fd;
+    struct stat st;
+    off_t pos;		/* its one chunk */
+    int size;
+    unsigned long serial;
+    int p[MAX_PASSES];
+    int failed;
+    int *failed_flag;	/* job_failed when it was added */
+    struct walk_node *node;
+    struct device *dev;
+};
+
+static __thread struct {
+    struct wipe_info *wi;
+    struct group_file *f;
+    int n;
+    char *buffer;	/* random data */
+    int buffer_size;
+} group;
+
+static int group_pending (void)
+{
+    return group.n > 0;
+}
+
+/* makes the last pass written to the group durable; a file system that
+ * fails to sync fails all its files */
+
+static void group_sync (void)
+{
+    struct group_file *g, *h;
+    char *fn;
+    int k, l, r;
+
+    for (k = 0; k<group.n; k++) {
+        g = &group.f[k];
+        if (g->failed) continue;
+#ifdef HAVE_SYNCFS
+        for (l = 0; l<k; l++)
+            if (!group.f[l].failed && group.f[l].st.st_dev == g->st.st_dev) break;
+        if (l < k) continue;
+        r = syncfs (g->fd);
+#else
+        r = fsync (g->fd);
+#endif
+        if (!r) continue;
+
+        fn = g->fn;
+        fnerror ("syncfs");
+        for (l = k; l<group.n; l++) {
+            h = &group.f[l];
+            if (h->st.st_dev == g->st.st_dev) h->failed = 1;
+        }
+    }
+}
+
+/* wipes the files of the group, pass by pass, then removes them */
+
+static int group_verify (struct wipe_info *wi, struct group_file *g, int pass)
+{
+    struct extent e;
+    struct extent_list el;
+    struct pass_job pj;
+
+    e.pos = g->pos;
+    e.len = g->size;
+    el.e = &e;
+    el.n = el.max = 1;
+    pass_job_init (&pj, &el);
+    return verify_pass (wi, g->dfd, g->fn, &g->st, &pj, pass, g->serial,
+            o_quick ? 0 : wi->passes[g->p[pass]]);
+}
+
+static void group_flush (void)
+{
+    struct wipe_info *wi = group.wi;
+    struct walk_node *keep = names_node;
+    struct wipe_pattern_buffer *wpb;
+    struct group_file *g;
+    struct device *dev = current_device;
+    uint64_t total = 0;
+    ssize_t wr;
+    char *fn;
+    int i, k, r;
+
+    if (!group.n) return;
+
+    for (k = 0; k<group.n; k++) {
+        total += group.f[k].size;
+        if (group.f[k].size <= group.buffer_size) continue;
+        free (group.buffer);
+        group.buffer_size = group.f[k].size;
+        group.buffer = xmalloc (group.buffer_size);
+    }
+    /* the group goes by the name of its first file */
+    progress_begin (group.f[0].fn, 0, wi->n_passes, total * wi->n_passes);
+
+    for (i = 0; i<wi->n_passes; i++) {
+        progress_pass (i);
+        if (!o_silent) {
+            fprintf (stderr, "\rWiping %d small files, pass %-2d   ", group.n, i);
+            middle_of_line = 1;
+        }
+        for (k = 0; k<group.n; k++) {
+            g = &group.f[k];
+            if (g->failed) continue;
+
+            wpb = o_quick ? 0 : wi->passes[g->p[i]];
+            if (wpb) wr = pwrite_tile (g->fd, wpb->buffer, g->size, g->pos);
+            else {
+                if (rand_Seekable ())
+                    rand_FillAt (PASS_STREAM (g->serial, i), g->pos,
+                            (u8 *) group.buffer, g->size);
+                else rand_Fill ((u8 *) group.buffer, g->size);
+                wr = pwrite (g->fd, group.buffer, g->size, g->pos);
+            }
+            if (wr != g->size) {
+                fn = g->fn;
+                if (wr < 0) { fnerror ("write error"); }
+                else { fnerrorq ("short write"); }
+                g->failed = 1;
+                continue;
+            }
+            current_device = g->dev;
+            count_written (g->size);
+        }
+        group_sync ();
+
+        if (verify_wanted (i, wi->n_passes))
+            for (k = 0; k<group.n; k++) {
+                g = &group.f[k];
+                if (!g->failed && group_verify (wi, g, i)) g->failed = 1;
+            }
+    }
+    current_device = dev;
+    progress_end ();
+
+    for (k = 0; k<group.n; k++) {
+        g = &group.f[k];
+        names_node = g->node;
+        if (!g->failed) inode_add (&g->st);
+        if (journal.fd >= 0 && !g->failed) journal_done (g->serial);
+        if (g->failed) {
+            close (g->fd);
+            r = -1;
+        } else r = job_finish (g->dfd, g->fn, g->fd, &g->st, 0);
+        if (r < 0 && g->failed_flag) __atomic_store_n (g->failed_flag, 1, __ATOMIC_RELAXED);
+        /* unless its name is still batched, the file is done with */
+        if (names_node) walk_done (names_node, r < 0);
+        if (g->dfd != AT_FDCWD) close (g->dfd);
+        free (g->fn);
+    }
+    group.n = 0;
+    names_node = keep;
+}
+
+/* puts off the wipe of fn, open as fd, whose only chunk is that of pj,
+ * until the group is full */
+
+static int group_add (struct wipe_info *wi, int dfd, char *fn, int fd, struct stat *st,
+        struct pass_job *pj, unsigned long serial)
+{
+    struct group_file *g;
+
+    if (!group.f) group.f = xmalloc (o_group * sizeof (*group.f));
+    g = &group.f[group.n];
+
+    g->dfd = dfd;
+    if (dfd != AT_FDCWD && (g->dfd = dup (dfd)) < 0) {
+        fnerror ("dup");
+        close (fd);
+        return -1;
+    }
+    g->fn = xmalloc (strlen (fn) + 1);
+    strcpy (g->fn, fn);
+    g->fd = fd;
+    g->st = *st;
+    pass_job_chunk (pj, 0, &g->pos, &g->size);
+    g->serial = serial;
+    memcpy (g->p, wi->p, sizeof (g->p));
+    g->failed = 0;
+    g->failed_flag = job_failed;
+    g->node = names_node;
+    names_node = 0;
+    g->dev = current_device;
+    group.wi = wi;
+
+    if (++ group.n == o_group) group_flush ();
+    return 0;
+}
+
+/* small file groups ***/
+
+/* puts the deterministic passes of p in a random order, drawn from the
+ * NUM_DETERMINISTIC_PASSES-2 values of r */
+
+static void shuffle_passes (int *p, u32 *r)
+{
+    int i;
+
+    for (i = 0; i<MAX_PASSES; p[i]=i, i++);
+
+    for (i = 0; i<NUM_DETERMINISTIC_PASSES-2; i++) {
+        int a, b;
+
+        /* a \in { 0, 1, ... NUM_DETERMINISTIC_PASSES-i-1 } */
+
+        /* since NUM_DETERMINISTIC_PASSES-i is not necessarily a divisor of
+         * 2^32, we won't get uniform distribution with this. however,
+         * since MAX_PASSES is very small compared to RAND_MAX, ti
+         */
+
+        a = r[i] % (NUM_DETERMINISTIC_PASSES-i);
+        b = p[FIRST_DETERMINISTIC_PASS+i+a];
+        p[FIRST_DETERMINISTIC_PASS+i+a] = p[FIRST_DETERMINISTIC_PASS+i];
+        p[FIRST_DETERMINISTIC_PASS+i] = b;
+    }
+}
+
+/* fn is relative to the directory dfd, or to the current directory if
+ * dfd is AT_FDCWD */
+
+static int dothejob (int dfd, char *fn)
+{
+    int fd;
+
+    struct progress pr;
+    int i;
+    off_t j;
+
+    /* each worker thread (-j) has its own */
+    static __thread struct wipe_info wi;
+    static __thread int wipe_info_initialized = 0;
+    static __thread struct extent_list el;
+    struct wipe_pattern_buffer *wpb = 0;
+    char *wbuf;
+    struct pass_job pj;
+    uint64_t item = 0;
+    int from_ring;
+
+    int *p = wi.p;
+
+    struct stat st;
+    off_t buffers_to_wipe; /* number of buffers to write on device */
+    off_t pos;
+    unsigned long serial;
+    off_t wipe_length;
+    int skip_passes;
+    int pass_order;
+    int largest_buffer_size;
+    int this_buffer_size;
+    int dalign = 0;
+    int relinked, small;
+    struct journal_entry *je;
+    int first_pass;
+    off_t first_offset, resume_chunk;
+    time_t journal_time = 0;
+    struct stripe_set ss;
+    int striped, n_stripes;
+    struct writeback wb;
+
+    fd_set w_fd;
+
+    /* passing a null filename pointer means: free your internal buffers, please. */
+    /* thanks to Thomas Schoepf and Alexey Marinichev for pointing this out */
+    if (!fn) {
+        group_flush ();
+        names_flush ();
+        if (wipe_info_initialized)
+            shut_wipe_info (&wi);
+        wipe_info_initialized = 0;
+        free (el.e);
+        el.e = 0;
+        el.n = el.max = 0;
+        if (o_jobs <= 1) abort_handler = NULL;
+        return 0;
+    }
+
+    /* whatever the last job of this thread was, it is over */
+    progress_end ();
+
+    /* skipping parameters (-X, -x) are only meant for the first file */
+    if (__atomic_exchange_n (&first_job, 0, __ATOMIC_RELAXED)) {
+        skip_passes = o_skip_passes;
+        pass_order = o_pass_order[0] >= 0;
+    } else {
+        skip_passes = 0;
+        pass_order = 0;
+    }
+
+    /* to do a cryptographically strong random permutation on the 
+     * order of the deterministic passes, we need
+     *   lg_2(NUM_DETERMINISTIC_PASSES!) bits of entropy:
+     * this means about 128 bits.
+     *
+     * rand_seed () should give 31 bits of entropy per call
+     * we need a maximum of lg_2(NUM_DETERMNISTIC_PASSES) bits of entropy per random
+     * value. therefore we should call rand_seed () at least for
+     * every 31/lg_2(NUM_DETERMNISTIC_PASSES) ~= 6 random values.
+     *
+     * on the other way, as we'll constantly force disk access,
+     * /dev/urandom should have no difficulty providing us good random
+     * values.
+     */
+
+    if (!o_quick && !pass_order) {
+        u32 r[NUM_DETERMINISTIC_PASSES];
+
+        for (i = 0; i<NUM_DETERMINISTIC_PASSES-2; i++) r[i] = rand_Get32 ();
+        shuffle_passes (p, r);
+    }
+
+    if (pass_order) {
+        for (i = 0; i<MAX_PASSES; i++) {
+            p[i] = o_pass_order[i];
+        }
+    }
+
+    /* see what kind of file it is */
+
+    if (fstatat (dfd, fn, &st, o_dereference_symlinks ? 0 : AT_SYMLINK_NOFOLLOW)) {
+        fnerror("stat or lstat error");
+        return -1;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        if (!o_silent) fprintf (stderr, "Skipping directory %.32s...\n", fn);
+        return 1;
+    }
+
+    /* checks if the file is a regular file, block device or character
+     * device. used to refuse to wipe block/char devices. thanks
+     * to Dan Hollis for pointing out this.
+     */
+
+    /* another link to it has been wiped: it only has to be removed */
+    relinked = S_ISREG(st.st_mode) && inode_wiped (&st);
+
+    /* may be wiped as part of a group, without O_SYNC */
+    small = o_group && S_ISREG(st.st_mode) && !relinked && !skip_passes && !o_direct &&
+        st.st_size <= o_buffer_size;
+
+    if ((S_ISREG(st.st_mode) && !relinked) || S_ISBLK(st.st_mode) || S_ISCHR(st.st_mode)) {
+#ifdef HAVE_OSYNC
+        fd = openat (dfd, fn, O_WRONLY | (o_writeback || small ? 0 : O_SYNC) | O_NONBLOCK);
+#else
+        fd = openat (dfd, fn, O_WRONLY | O_NONBLOCK);
+#endif
+
+        if (fd < 0) {
+            if (errno == EACCES) {
+                if (o_force || o_dochmod) {
+                    if (fchmodat (dfd, fn, 0700, 0)) {
+                        fnerror("chmod error");
+                        return -1;
+                    } else fd = openat (dfd, fn, O_WRONLY);
+                } else { fnerror("permission error: try -c"); return -1; }
+            } else { fnerror("open error"); return -1; }
+        }
+        if (fd < 0) { fnerror("open error even with chmod"); return -1; }
+
+#ifdef HAVE_O_DIRECT
+        if (o_direct) dalign = get_direct_align (fd, &st);
+#endif
+
+        wipe_length = o_wipe_length;
+        if (!o_wipe_length_set) {
+            if (S_ISBLK(st.st_mode)) {
+#ifdef FIND_DEVICE_SIZE_BY_BLKGETSIZE
+                /* get device size in blocks */
+                {
+#ifndef SIXTYFOUR
+                    long l;
+
+                    if (ioctl (fd, BLKGETSIZE, &l)) {
+                        fnerror ("could not get device block size via ioctl BLKGETSIZE; check option -l");
+                        return -1;
+                    }
+                    wipe_length = l << 9; /* assume 512-byte blocks */
+#else
+                    long long l;
+
+                    if (ioctl (fd, BLKGETSIZE64, &l)) {
+                        fnerror ("could not get device block size via ioctl BLKGETSIZE64; check option -l");
+                        return -1;
+                    }
+		    wipe_length = l; /* BLKGETSIZE64 returns bytes */
+#endif
+
+                }
+#else
+                {
+#ifdef SIXTYFOUR
+                    long long l;
+                    /* find device size by seeking... might work on some devices */
+                    l = lseek64 (fd, 0, SEEK_END);
+                    if (!l) {
+                        fnerror ("could not get device block size with lseek; check option -l");
+                    }
+                    debugf ("lseek -> %d", l);
+                    wipe_length = l;
+#else
+                    off_t l;
+                    /* find device size by seeking... might work on some devices */
+                    l = lseek (fd, 0, SEEK_END);
+                    if (!l) {
+                        fnerror ("could not get device block size with lseek; check option -l");
+                    }
+                    debugf ("lseek -> %d", l);
+                    wipe_length = l;
+#endif
+                }
+#endif
+                debugf ("block device block size %d", st.st_blksize);
+            } else {
+                /* not a block device */
+                wipe_length = st.st_size;
+                if (!o_wipe_exact_size) {
+                    wipe_length += st.st_blksize - (wipe_length % st.st_blksize);
+                }
+            }
+            wipe_length -= o_wipe_offset;
+        }
+
+        /* don't do anything to zero-sized files */
+        if (!wipe_length) {
+            goto skip_wipe;
+        }
+
+#if SIXTYFOUR
+        debugf ("wipe_length = %Ld", wipe_length);
+#else
+        debugf ("wipe_length = %ld", wipe_length);
+#endif
+
+        /* compute number of writes: only allocated extents of files are
+         * written, with the last block they end in */
+        map_extents (&el, fd, &st, o_wipe_offset, o_wipe_offset + wipe_length);
+        largest_buffer_size = pass_job_init (&pj, &el);
+        buffers_to_wipe = pj.n_buffers;
+
+        debugf ("buffers_to_wipe = %d in %d extents, largest_buffer_size = %d",
+                buffers_to_wipe, el.n, largest_buffer_size);
+
+        /* nothing allocated */
+        if (!buffers_to_wipe) {
+            goto skip_wipe;
+        }
+
+        /* initialize wipe info */
+        if (!wipe_info_initialized) {
+            init_wipe_info (&wi, max (sysconf (_SC_PAGESIZE), dalign));
+            wipe_info_initialized = 1;
+            if (o_jobs <= 1) {
+                abort_handler = wipe_continuation_message;
+                abort_handler_arg = &wi;
+            }
+        }
+
+        /* if the possibly existing leftover random buffers
+         * from the last wipe are shorter than what we need for
+         * now, mark all of them as used.
+         *
+         * ok it's possible to have a smarter random buffer management,
+         * but it only helps on small files (i.e. files smaller than the
+         * buffer size) so it's not really worth it (in other words:
+         * you can't escape from linear asymptotic complexity:)
+         */
+
+        {
+            int x = largest_buffer_size;
+
+            if (x > wi.random_length)
+                dirty_all_buffers (&wi);
+
+            wi.random_length = x;
+
+            n_stripes = buffers_to_wipe > 1 ? (o_stripes < buffers_to_wipe ? o_stripes : buffers_to_wipe) : 1;
+            /* stripes fill their buffers with rand_FillAt (): the other
+             * generators cannot be cut into stripes */
+            if (!rand_Seekable ()) n_stripes = 1;
+            size_buffers (&wi, x, buffers_to_wipe, &n_stripes);
+        }
+
+        debugf ("buffers_to_wipe = %d, o_buffer_size = %d, wi.n_passes = %d",
+                buffers_to_wipe, o_buffer_size, wi.n_passes);
+
+        /* an interrupted run may have wiped some of it already */
+        je = journal.n ? journal_find (&st) : 0;
+        if (je && je->n_passes != wi.n_passes) {
+            if (!o_silent) {
+                FLUSH_MIDDLE;
+                fprintf (stderr, "\r%.32s: journaled with another number of passes, wiping it again\n", fn);
+            }
+            je = 0;
+        }
+        if (je && je->done) goto skip_wipe;
+
+        first_pass = skip_passes;
+        first_offset = 0;
+        if (je) {
+            serial = je->serial;
+            memcpy (p, je->p, je->n_passes * sizeof (*p));
+            first_pass = je->pass;
+            first_offset = je->offset;
+        } else {
+            serial = __atomic_fetch_add (&wipe_serial, 1, __ATOMIC_RELAXED);
+            if (journal.fd >= 0) {
+                /* drawn from the serial, so that a resumed run orders the
+                 * passes of the files it starts as this one would have */
+                if (!o_quick && !pass_order) {
+                    u32 r[NUM_DETERMINISTIC_PASSES];
+
+                    rand_FillAt (ORDER_STREAM (serial), 0, (u8 *) r, sizeof (r));
+                    shuffle_passes (p, r);
+                }
+                journal_start (&st, serial, p, wi.n_passes, fn);
+            }
+        }
+
+        if (small && buffers_to_wipe == 1 && !first_pass)
+            return group_add (&wi, dfd, fn, fd, &st, &pj, serial);
+
+#ifdef HAVE_O_DIRECT
+        if (o_direct) open_direct (&wi, dfd, fn, &st, dalign);
+#endif
+
+        progress_begin (fn, first_pass, wi.n_passes,
+                (uint64_t) pj.length * (wi.n_passes - first_pass));
+
+        /* stripe threads add to the same count */
+        striped = n_stripes > 1;
+        if (striped) stripes_start (&ss, &wi, fd, &pj, n_stripes);
+
+        /* do the passes */
+        pr.bpi = 0;
+        pr.skip = first_pass;
+        eta_begin();
+        for (i = first_pass; i<=wi.n_passes; i++) {
+            ssize_t wr;
+
+            /* the previous pass is on the disk */
+            if (i > first_pass) {
+                if (verify_wanted (i - 1, wi.n_passes) && !S_ISCHR(st.st_mode) &&
+                        verify_pass (&wi, dfd, fn, &st, &pj, i - 1, serial,
+                            (o_quick || !wi.passes[p[i - 1]]) ? 0 : wi.passes[p[i - 1]])) {
+                    if (striped) stripes_stop (&ss);
+                    close_direct (&wi);
+                    close (fd);
+                    return -1;
+                }
+                if (journal.fd >= 0) journal_progress (serial, i, -1, 0, &journal_time);
+            }
+            if (i == wi.n_passes) break;
+
+            wi.current_pass = i;
+            progress_pass (i);
+
+            if (!o_silent) {
+                if (o_quick) 
+                    fprintf (stderr, "\rWipoing %.32s, pass %d in quick mode   ", fn, i);
+                else
+                    fprintf (stderr, "\rWiping %.32s, pass %-2d (%-2d)   ", fn, i, p[i]);
+                middle_of_line = 1;
+            }
+
+            if (!o_silent) pr.lt = time (0);
+
+            if (o_offload && !o_quick && zero_pass (wi.passes[p[i]])) {
+                if (!offload_zero (fd, &st, &pj)) {
+                    if (sync_pass (fd)) {
+                        fnerror ("fsync error [2]");
+                        if (striped) stripes_stop (&ss);
+                        close_direct (&wi);
+                        close (fd);
+                        return -1;
+                    }
+                    count_written (pj.length);
+                    continue;
+                }
+                if (o_verbose) {
+                    FLUSH_MIDDLE;
+                    fprintf (stderr, "\r%.32s: zero pass not offloaded (%s), writing it\n",
+                            fn, strerror (errno));
+                }
+            }
+
+            /* a resumed pass starts with the first chunk not on the disk;
+             * uring and striped passes start over */
+            resume_chunk = 0;
+            if (i == first_pass && first_offset && !striped)
+                resume_chunk = pass_job_find (&pj, first_offset);
+#ifdef HAVE_IO_URING
+            if (wi.uring_active) resume_chunk = 0;
+#endif
+
+            pj.stream = PASS_STREAM (serial, i);
+            pj.first = resume_chunk;
+            if (wi.ring_active && !striped && (o_quick || !wi.passes[p[i]]))
+                ring_Start (&wi.ring, pass_job_fill, &pj, buffers_to_wipe - resume_chunk);
+
+#ifdef HAVE_IO_URING
+            if (wi.uring_active) {
+                if (uring_pass (&wi, &pr, fd, fn, i, &pj,
+                            (o_quick || !wi.passes[p[i]]) ? 0 : wi.passes[p[i]])) {
+                    if (wi.ring_active) ring_Cancel (&wi.ring);
+                    close_direct (&wi);
+                    close (fd);
+                    return -1;
+                }
+                continue;
+            }
+#endif
+
+            if (striped) {
+                if (stripes_pass (&ss, &pr, fn, i,
+                            (o_quick || !wi.passes[p[i]]) ? 0 : wi.passes[p[i]])) {
+                    stripes_stop (&ss);
+                    close_direct (&wi);
+                    close (fd);
+                    return -1;
+                }
+                continue;
+            }
+
+            writeback_init (&wb, fd, resume_chunk ? first_offset : el.e[0].pos);
+            for (j = resume_chunk; j<buffers_to_wipe; j ++) {
+                pass_job_chunk (&pj, j, &pos, &this_buffer_size);
+
+                /* with --progress-fd, the progress thread does it */
+                if (!o_silent && o_progress_fd < 0)
+                    show_progress (&pr, i, j, buffers_to_wipe, wi.n_passes);
+
+                /* get a fresh random buffer */
+                {
+                    from_ring = 0;
+                    if (o_quick || !wi.passes[p[i]]) {
+                        if (wi.ring_active) {
+                            wbuf = ring_Get (&wi.ring, &item);
+                            from_ring = 1;
+                        } else if (rand_Seekable ()) {
+                            wbuf = wi.random_buffers[0].buffer;
+                            rand_FillAt (PASS_STREAM (serial, i), pos,
+                                    (u8 *) wbuf, this_buffer_size);
+                        } else {
+                            wpb = get_random_buffer (&wi);
+                            wbuf = wpb->buffer;
+                        }
+                    } else {
+                        wpb = wi.passes[p[i]];
+                        wbuf = wpb->buffer;
+                    }
+
+                    for (;;) {
+                        if (o_quick || !wi.passes[p[i]])
+                            wr = pwrite (write_fd (&wi, fd, pos, this_buffer_size), wbuf,
+                                    this_buffer_size, pos); /* asynchronous write */
+                        else
+                            wr = pwrite_tile (write_fd (&wi, fd, pos, this_buffer_size), wbuf,
+                                    this_buffer_size, pos);
+
+                        if (wr < 0) {
+                            if (errno == EAGAIN) {
+                                /* since we are idle we can do some socially useful
+                                 * work.
+                                 */
+                                if (revitalize_random_buffers (&wi)) {
+                                    /* there isn't anything we can do to occupy ourselves,
+                                     * so we'll just wait until our previous write requests
+                                     * are queued, and retry.
+                                     */
+                                    FD_ZERO (&w_fd);
+                                    FD_SET (fd, &w_fd);
+                                    if (select (fd + 1, 0, &w_fd, 0, 0) < 0) {
+                                        fnerror ("select");
+                                        if (from_ring) ring_Put (&wi.ring, item);
+                                        if (wi.ring_active) ring_Cancel (&wi.ring);
+                                        close_direct (&wi);
+                                        close (fd);
+                                        return -1;
+                                    }
+
+                                    /* we MUST have FD_ISSET(&w_fd) */
+                                }
+                            } else {
+                                fnerror ("write error");
+                                exit (EXIT_FAILURE);
+                            }
+                        } else if (wr != this_buffer_size) {
+                            /* argh short write... what does this mean exactly with
+                             * non-blocking i/o ? */
+                            debugf ("short write, expecting %d got %d",
+                                    this_buffer_size, wr);
+                            fnerror ("short write");
+                            if (from_ring) ring_Put (&wi.ring, item);
+                            if (wi.ring_active) ring_Cancel (&wi.ring);
+                            close_direct (&wi);
+                            close (fd);
+                            return -1;
+                        } else break;
+                    }
+
+                    if (from_ring) ring_Put (&wi.ring, item);
+                    writeback_written (&wb, pos, this_buffer_size);
+                    count_written (this_buffer_size);
+                }
+
+#ifndef HAVE_OSYNC
+                if (!o_writeback && fsync (fd)) {
+                    fnerror ("fsync error [1]");
+                    if (wi.ring_active) ring_Cancel (&wi.ring);
+                    close_direct (&wi);
+                    close (fd);
+                    return -1;
+                }
+#endif
+                if (journal.fd >= 0) journal_progress (serial, i, fd, wb.pos, &journal_time);
+            }
+
+            if (sync_pass (fd)) {
+                fnerror ("fsync error [2]");
+                close_direct (&wi);
+                close (fd);
+                return -1;
+            }
+        }
+        if (striped) stripes_stop (&ss);
+        close_direct (&wi);
+        if (journal.fd >= 0) journal_done (serial);
+        progress_end ();
+
+        if (o_discard && (S_ISBLK(st.st_mode) || (S_ISREG(st.st_mode) && o_no_remove))
+                && offload_discard (fd, &st, &pj) && !o_silent) {
+            FLUSH_MIDDLE;
+            fprintf (stderr, "\r%.32s: could not discard (%s)\n", fn, strerror (errno));
+        }
+
+        /* try to wipe out file size by truncating at various sizes... */
+
+skip_wipe:
+        /* the data is gone: other names of the file need not be wiped */
+        if (S_ISREG(st.st_mode)) inode_add (&st);
+        return job_finish (dfd, fn, fd, &st, relinked);
+    }
+
+    return job_finish (dfd, fn, -1, &st, relinked);
+}
+
+/*** worker pool */
+
+/* with -j N, files are wiped by N worker threads, each with its own
+ * wipe_info, sequential generator and statistics.  the main thread only
+ * walks the command line and the directories, and queues the files.
+ * workers may run while the main thread is in another directory, so
+ * each job holds a descriptor of its own on the directory of its file.
  *
- * select
+ * jobs are grouped by disk: a worker takes the oldest queued job whose
+ * disk runs fewer than o_device_jobs jobs, so that disks are wiped side
+ * by side while two partitions of the same disk do not seek against each
+ * other.  -j 0 starts one worker per disk named on the command line.
  */
 
-#define max(x,y) ((x>y)?x:y)
+#define MAX_JOBS 256
+#define JOB_QUEUE 64
 
-static int dothejob (char *fn)
-{
-    int fd;
+struct job {
+    int dfd;		/* fn is relative to it; closed after the job */
+    char *fn;
+    int *failed;	/* set if the job fails; 0 counts the failure as an error */
+    struct walk_node *node;	/* with --walkers, the directory, which owns dfd */
+    struct device *dev;
+};
+
+struct job_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t more, room, done;
+    struct job queue[JOB_QUEUE];	/* oldest first */
+    int count;
+    int busy;		/* jobs queued or running */
+    int closing;
+    int n_workers;
+    pthread_t workers[MAX_JOBS];
+
+    /* statistics of the workers that have exited */
+    int num_errors, num_files, num_dirs, num_spec, num_symlinks;
 
-    int bpi = 0;	/* block progress indicator enabled ? */
+    double start, last_report;
+};
+
+static struct job_pool pool;
+
+/* index of the first job that may run now, -1 if none */
+
+static int pool_next_job (void)
+{
     int i;
-    off_t j;
 
-    static struct wipe_info wi;
-    static int wipe_info_initialized = 0;
-    struct wipe_pattern_buffer *wpb = 0;
+    for (i = 0; i<pool.count; i++)
+        if (pool.queue[i].dev->active < o_device_jobs) return i;
+    return -1;
+}
 
-    int *p = wi.p;
+static void *job_worker (void *a)
+{
+    struct job jb;
+    int i, r, failed, held = 0;
 
-    struct stat st;
-    off_t buffers_to_wipe; /* number of buffers to write on device */
-    int first_buffer_size;
-    int last_buffer_size;
-    int this_buffer_size;
+    rand_InitThread ((unsigned) (long) a);
+
+    pthread_mutex_lock (&pool.lock);
+    for (;;) {
+        while ((i = pool_next_job ()) < 0 && !(pool.closing && !pool.count)) {
+            /* nothing to do: the batched renames go now */
+            if (held) {
+                pthread_mutex_unlock (&pool.lock);
+                group_flush ();
+                names_flush ();
+                pthread_mutex_lock (&pool.lock);
+                held = 0;
+                if (!--pool.busy) pthread_cond_broadcast (&pool.done);
+                continue;
+            }
+            pthread_cond_wait (&pool.more, &pool.lock);
+        }
+        if (i < 0) break;
+
+        jb = pool.queue[i];
+        memmove (&pool.queue[i], &pool.queue[i + 1], (pool.count - i - 1) * sizeof (jb));
+        pool.count --;
+        if (!jb.dev->active++ && !jb.dev->first) jb.dev->first = get_time_of_day ();
+        pthread_cond_signal (&pool.room);
+        pthread_mutex_unlock (&pool.lock);
+
+        current_device = jb.dev;
+        names_node = jb.node;
+        job_failed = jb.failed;
+        r = dothejob (jb.dfd, jb.fn);
+        progress_end ();
+        if (r < 0) {
+            failed = 1;
+            if (jb.failed) __atomic_store_n (jb.failed, 1, __ATOMIC_RELAXED);
+            else if (!jb.node) num_errors ++;
+        } else failed = 0;
+        current_device = 0;
+        free (jb.fn);
+        /* unless its name is still batched, the file is done with */
+        if (names_node) walk_done (names_node, failed);
+        names_node = 0;
+        job_failed = 0;
+        if (!jb.node && jb.dfd != AT_FDCWD) close (jb.dfd);
+
+        pthread_mutex_lock (&pool.lock);
+        jb.dev->active --;
+        jb.dev->last = get_time_of_day ();
+        /* files whose names are still batched, or that wait for the
+         * rest of their group, keep the worker busy, so that their
+         * directory is not removed before they are gone */
+        pool.busy -= 1 + held - (names_pending () || group_pending ());
+        held = names_pending () || group_pending ();
+        if (!pool.busy) pthread_cond_broadcast (&pool.done);
+        /* a job of this disk may have been waiting */
+        pthread_cond_broadcast (&pool.more);
+    }
+    pthread_mutex_unlock (&pool.lock);
 
-    time_t lt = 0, t;
+    /* free internal buffers */
+    dothejob (AT_FDCWD, 0);
 
-    fd_set w_fd;
+    pthread_mutex_lock (&pool.lock);
+    pool.num_errors += num_errors;
+    pool.num_files += num_files;
+    pool.num_dirs += num_dirs;
+    pool.num_spec += num_spec;
+    pool.num_symlinks += num_symlinks;
+    pthread_mutex_unlock (&pool.lock);
 
-    /* passing a null filename pointer means: free your internal buffers, please. */
-    /* thanks to Thomas Schoepf and Alexey Marinichev for pointing this out */
-    if (!fn) {
-        if (wipe_info_initialized)
-            shut_wipe_info (&wi);
-        abort_handler = NULL;
-        return 0;
+    return 0;
+}
+
+static void pool_start (int n)
+{
+    pthread_mutex_init (&pool.lock, 0);
+    pthread_cond_init (&pool.more, 0);
+    pthread_cond_init (&pool.room, 0);
+    pthread_cond_init (&pool.done, 0);
+    pool.start = pool.last_report = get_time_of_day ();
+
+    for (pool.n_workers = 0; pool.n_workers < n; pool.n_workers ++) {
+        /* worker i gets sequential generator i + 1, the main thread's is 0 */
+        if (pthread_create (&pool.workers[pool.n_workers], 0, job_worker,
+                    (void *) (long) (pool.n_workers + 1))) {
+            fprintf (stderr, "could not start worker threads");
+            exit (EXIT_FAILURE);
+        }
     }
+}
 
-    /* to do a cryptographically strong random permutation on the 
-     * order of the deterministic passes, we need
-     *   lg_2(NUM_DETERMINISTIC_PASSES!) bits of entropy:
-     * this means about 128 bits.
-     *
-     * rand_seed () should give 31 bits of entropy per call
-     * we need a maximum of lg_2(NUM_DETERMNISTIC_PASSES) bits of entropy per random
-     * value. therefore we should call rand_seed () at least for
-     * every 31/lg_2(NUM_DETERMNISTIC_PASSES) ~= 6 random values.
-     *
-     * on the other way, as we'll constantly force disk access,
-     * /dev/urandom should have no difficulty providing us good random
-     * values.
-     */
+/* shows the throughput of every disk being wiped, and the total, over
+ * the last report interval */
 
-    if (!o_quick && o_pass_order[0] < 0) {
-        for (i = 0; i<MAX_PASSES; p[i]=i, i++);
+static void pool_report (void)
+{
+    double now, dt;
+    uint64_t b, total = 0;
+    int i;
 
-        for (i = 0; i<NUM_DETERMINISTIC_PASSES-2; i++) {
-            int a, b;
+    now = get_time_of_day ();
+    dt = now - pool.last_report;
+    if (dt <= 0) return;
+
+    fprintf (stderr, "\r");
+    for (i = 0; i<n_devices; i++) {
+        b = __atomic_load_n (&devices[i]->bytes, __ATOMIC_RELAXED);
+        if (devices[i]->active)
+            fprintf (stderr, "%s %.1f MB/s  ", devices[i]->name,
+                    (b - devices[i]->last_bytes) / dt / 1e6);
+        total += b - devices[i]->last_bytes;
+        devices[i]->last_bytes = b;
+    }
+    fprintf (stderr, "total %.1f MB/s   ", total / dt / 1e6);
+    fflush (stderr);
+    middle_of_line = 1;
+    pool.last_report = now;
+}
 
-            /* a \in { 0, 1, ... NUM_DETERMINISTIC_PASSES-i-1 } */
+/* waits on c, reporting throughput every few seconds meanwhile */
 
-            /* since NUM_DETERMINISTIC_PASSES-i is not necessarily a divisor of
-             * 2^32, we won't get uniform distribution with this. however,
-             * since MAX_PASSES is very small compared to RAND_MAX, ti
-             */
+static void pool_cond_wait (pthread_cond_t *c)
+{
+    struct timespec ts;
 
-            a = rand_Get32 () % (NUM_DETERMINISTIC_PASSES-i);
-            b = p[FIRST_DETERMINISTIC_PASS+i+a];
-            p[FIRST_DETERMINISTIC_PASS+i+a] = p[FIRST_DETERMINISTIC_PASS+i];
-            p[FIRST_DETERMINISTIC_PASS+i] = b;
-        }
+    if (o_silent) {
+        pthread_cond_wait (c, &pool.lock);
+        return;
     }
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_sec += 1;
+    if (pthread_cond_timedwait (c, &pool.lock, &ts) &&
+            get_time_of_day () - pool.last_report >= 5)
+        pool_report ();
+}
 
-    if (o_pass_order[0] >= 0) {
-        for (i = 0; i<MAX_PASSES; i++) {
-            p[i] = o_pass_order[i];
+/* queues fn, which must be malloc'ed, for the disk of st; the job owns
+ * dfd unless it is AT_FDCWD or that of node.  waits while the queue is
+ * full */
+
+static void pool_submit (int dfd, char *fn, int *failed, struct walk_node *node,
+        struct stat *st)
+{
+    struct device *dv = find_device (st);
+
+    pthread_mutex_lock (&pool.lock);
+    while (pool.count == JOB_QUEUE) pool_cond_wait (&pool.room);
+    pool.queue[pool.count].dfd = dfd;
+    pool.queue[pool.count].fn = fn;
+    pool.queue[pool.count].failed = failed;
+    pool.queue[pool.count].node = node;
+    pool.queue[pool.count].dev = dv;
+    pool.count ++;
+    pool.busy ++;
+    pthread_cond_broadcast (&pool.more);
+    pthread_mutex_unlock (&pool.lock);
+}
+
+/* waits until every queued job has been run */
+
+static void pool_wait (void)
+{
+    pthread_mutex_lock (&pool.lock);
+    while (pool.busy) pool_cond_wait (&pool.done);
+    pthread_mutex_unlock (&pool.lock);
+}
+
+static void pool_stop (void)
+{
+    double t;
+    int i;
+
+    pool_wait ();
+
+    pthread_mutex_lock (&pool.lock);
+    pool.closing = 1;
+    pthread_cond_broadcast (&pool.more);
+    pthread_mutex_unlock (&pool.lock);
+
+    for (i = 0; i<pool.n_workers; i++) pthread_join (pool.workers[i], 0);
+
+    num_errors += pool.num_errors;
+    num_files += pool.num_files;
+    num_dirs += pool.num_dirs;
+    num_spec += pool.num_spec;
+    num_symlinks += pool.num_symlinks;
+
+    if (!o_silent) {
+        uint64_t total = 0;
+
+        FLUSH_MIDDLE
+        for (i = 0; i<n_devices; i++) {
+            t = devices[i]->last - devices[i]->first;
+            fprintf (stderr, "%s: %.1f MB written in %.1f s, %.1f MB/s\n",
+                    devices[i]->name, devices[i]->bytes / 1e6, t,
+                    t > 0 ? devices[i]->bytes / t / 1e6 : 0.0);
+            total += devices[i]->bytes;
         }
+        t = get_time_of_day () - pool.start;
+        fprintf (stderr, "total: %.1f MB written in %.1f s, %.1f MB/s\n",
+                total / 1e6, t, t > 0 ? total / t / 1e6 : 0.0);
     }
+}
 
-    /* see what kind of file it is */
+/* dir/fn, or a copy of fn if dir is null */
 
-    if (o_dereference_symlinks ? stat (fn, &st) : lstat (fn, &st)) {
-        fnerror("stat or lstat error");
-        return -1;
-    }
+static char *job_path (char *dir, char *fn)
+{
+    char *path;
 
-    if (S_ISDIR(st.st_mode)) {
-        if (!o_silent) fprintf (stderr, "Skipping directory %.32s...\n", fn);
-        return 1;
+    if (!dir) {
+        path = xmalloc (strlen (fn) + 1);
+        strcpy (path, fn);
+        return path;
     }
 
-    /* checks if the file is a regular file, block device or character
-     * device. used to refuse to wipe block/char devices. thanks
-     * to Dan Hollis for pointing out this.
-     */
+    path = xmalloc (strlen (dir) + strlen (fn) + 2);
+    sprintf (path, "%s/%s", dir, fn);
+    return path;
+}
 
-    if (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode) || S_ISCHR(st.st_mode)) {
-#ifdef HAVE_OSYNC
-        fd = open (fn, O_WRONLY | O_SYNC | O_NONBLOCK);
-#else
-        fd = open (fn, O_WRONLY | O_NONBLOCK);
-#endif
+/* worker pool ***/
 
-        if (fd < 0) {
-            if (errno == EACCES) {
-                if (o_force || o_dochmod) {
-                    if (chmod (fn, 0700)) {
-                        fnerror("chmod error");
-                        return -1;
-                    } else fd = open (fn, O_WRONLY);
-                } else { fnerror("permission error: try -c"); return -1; }
-            } else { fnerror("open error"); return -1; }
-        }
-        if (fd < 0) { fnerror("open error even with chmod"); return -1; }
+/*** elevator */
 
-        if (!o_wipe_length_set) {
-            if (S_ISBLK(st.st_mode)) {
-#ifdef FIND_DEVICE_SIZE_BY_BLKGETSIZE
-                /* get device size in blocks */
-                {
-#ifndef SIXTYFOUR
-                    long l;
+/* with --elevator, recursive () only plans: regular files are collected
+ * with the physical offset of their first block, then wiped in
+ * ascending physical order on each device, so that a rotational disk
+ * sweeps across the tree instead of seeking to every file in readdir
+ * order.  directories are removed afterwards, children first, unless
+ * something below them failed. */
 
-                    if (ioctl (fd, BLKGETSIZE, &l)) {
-                        fnerror ("could not get device block size via ioctl BLKGETSIZE; check option -l");
-                        return -1;
-                    }
-                    o_wipe_length = l << 9; /* assume 512-byte blocks */
-#else
-                    long long l;
+struct plan_file {
+    char *path;		/* from the current directory, which never changes */
+    struct stat st;
+    uint64_t phys;
+    int seq;		/* readdir order, among files at the same place */
+    int dir;		/* index of its directory, or -1 */
+};
 
-                    if (ioctl (fd, BLKGETSIZE64, &l)) {
-                        fnerror ("could not get device block size via ioctl BLKGETSIZE64; check option -l");
-                        return -1;
-                    }
-		    o_wipe_length = l; /* BLKGETSIZE64 returns bytes */
-#endif
+struct plan_dir {
+    char *path;
+    int parent;
+    int failed;
+};
 
-                }
-#else
-                {
-#ifdef SIXTYFOUR
-                    long long l;
-                    /* find device size by seeking... might work on some devices */
-                    l = lseek64 (fd, 0, SEEK_END);
-                    if (!l) {
-                        fnerror ("could not get device block size with lseek; check option -l");
-                    }
-                    debugf ("lseek -> %d", l);
-                    o_wipe_length = l;
+static struct {
+    struct plan_file *files;
+    int n_files, max_files;
+    struct plan_dir *dirs;
+    int n_dirs, max_dirs;
+    int dir;		/* directory being walked */
+    int failed;		/* for files given on the command line */
+} plan = { 0, 0, 0, 0, 0, 0, -1, 0 };
+
+static uint64_t physical_offset (int dfd, char *fn)
+{
+#ifdef HAVE_FIEMAP
+    struct {
+        struct fiemap fm;
+        struct fiemap_extent fe[1];
+    } m;
+    int fd;
+
+    fd = openat (dfd, fn, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) return 0;
+    memset (&m.fm, 0, sizeof (m.fm));
+    m.fm.fm_length = FIEMAP_MAX_OFFSET;
+    m.fm.fm_extent_count = 1;
+    if (ioctl (fd, FS_IOC_FIEMAP, &m.fm) || !m.fm.fm_mapped_extents) m.fe[0].fe_physical = 0;
+    close (fd);
+    return m.fe[0].fe_physical;
 #else
-                    off_t l;
-                    /* find device size by seeking... might work on some devices */
-                    l = lseek (fd, 0, SEEK_END);
-                    if (!l) {
-                        fnerror ("could not get device block size with lseek; check option -l");
-                    }
-                    debugf ("lseek -> %d", l);
-                    o_wipe_length = l;
-#endif
-                }
+    return 0;
 #endif
-                debugf ("block device block size %d", st.st_blksize);
-            } else {
-                /* not a block device */
-                o_wipe_length = st.st_size;
-                if (!o_wipe_exact_size) {
-                    o_wipe_length += st.st_blksize - (o_wipe_length % st.st_blksize);
-                }
-            }
-            o_wipe_length -= o_wipe_offset;
-        }
+}
 
-        /* don't do anything to zero-sized files */
-        if (!o_wipe_length) {
-            goto skip_wipe;
+/* fn is in the directory dfd, whose path is dir */
+
+static int plan_file (int dfd, char *fn, char *dir, struct stat *st)
+{
+    struct plan_file *f;
+
+    if (plan.n_files == plan.max_files) {
+        plan.max_files = plan.max_files ? 2 * plan.max_files : 256;
+        plan.files = realloc (plan.files, plan.max_files * sizeof (*plan.files));
+        if (!plan.files) { fnerrorq ("out of memory for the plan"); return -1; }
+    }
+    f = &plan.files[plan.n_files];
+    f->path = job_path (dir, fn);
+    f->st = *st;
+    f->phys = physical_offset (dfd, fn);
+    f->seq = plan.n_files ++;
+    f->dir = plan.dir;
+    return 0;
+}
+
+/* returns the index of the new directory */
+
+static int plan_dir (char *fn)
+{
+    struct plan_dir *d;
+
+    if (plan.n_dirs == plan.max_dirs) {
+        plan.max_dirs = plan.max_dirs ? 2 * plan.max_dirs : 64;
+        plan.dirs = realloc (plan.dirs, plan.max_dirs * sizeof (*plan.dirs));
+        if (!plan.dirs) { fnerrorq ("out of memory for the plan"); return -1; }
+    }
+    d = &plan.dirs[plan.n_dirs];
+    d->path = job_path (0, fn);
+    d->parent = plan.dir;
+    d->failed = 0;
+    return plan.n_dirs ++;
+}
+
+static int plan_compare (const void *a, const void *b)
+{
+    const struct plan_file *x = a, *y = b;
+
+    if (x->st.st_dev != y->st.st_dev) return x->st.st_dev < y->st.st_dev ? -1 : 1;
+    if (x->phys != y->phys) return x->phys < y->phys ? -1 : 1;
+    return x->seq - y->seq;
+}
+
+/* wipes what has been planned */
+
+static int plan_run (void)
+{
+    struct plan_file *f;
+    struct plan_dir *d;
+    int i, *failed, r = 0;
+    char *fn;
+
+    qsort (plan.files, plan.n_files, sizeof (*plan.files), plan_compare);
+
+    for (i = 0; i<plan.n_files; i++) {
+        f = &plan.files[i];
+        failed = f->dir < 0 ? &plan.failed : &plan.dirs[f->dir].failed;
+        if (o_errorabort && (r || __atomic_load_n (&plan.failed, __ATOMIC_RELAXED))) {
+            free (f->path);
+            continue;
         }
+        if (o_jobs > 1) pool_submit (AT_FDCWD, f->path, failed, 0, &f->st);
+        else {
+            job_failed = failed;
+            if (dothejob (AT_FDCWD, f->path) < 0) *failed = 1;
+            job_failed = 0;
+            abort_handler = NULL;
+            free (f->path);
+        }
+        if (*failed) r = -1;
+    }
+    if (o_jobs > 1) pool_wait ();
+    group_flush ();
+    names_flush ();
+
+    /* children come after their parents */
+    for (i = plan.n_dirs - 1; i >= 0; i--) {
+        d = &plan.dirs[i];
+        fn = d->path;
+        if (!d->failed && !o_no_remove && rmdir (fn)) {
+            fnerror ("rmdir");
+            d->failed = 1;
+        }
+        if (d->failed) {
+            if (d->parent >= 0) plan.dirs[d->parent].failed = 1;
+            else plan.failed = 1;
+        }
+        free (fn);
+    }
+    if (plan.failed) r = -1;
 
-#if SIXTYFOUR
-        debugf ("o_wipe_length = %Ld", o_wipe_length);
-#else
-        debugf ("o_wipe_length = %ld", o_wipe_length);
-#endif
+    free (plan.files);
+    free (plan.dirs);
+    memset (&plan, 0, sizeof (plan));
+    plan.dir = -1;
+    return r;
+}
 
-        /* compute number of writes... */
-        {
-            int fb, lb;
+/* elevator ***/
 
-            fb = o_wipe_offset >> o_lg2_buffer_size;
-            lb = (o_wipe_offset + o_wipe_length + o_buffer_size - 1) >> o_lg2_buffer_size;
-            buffers_to_wipe = lb - fb;
+/*** recursive */
 
-            debugf ("fb = %d lb = %d", fb, lb);
+/* directories are walked with an explicit stack of open directories.
+ * every name is opened relative to the descriptor of its directory
+ * (openat (), fstatat (), unlinkat ()), so the process never changes its
+ * current directory, paths of any length can be walked and a directory
+ * renamed meanwhile cannot send us somewhere else.  the type readdir ()
+ * gives spares an fstatat () for every file that is not a directory. */
 
-            if (buffers_to_wipe == 1) {
-                last_buffer_size = first_buffer_size = o_wipe_length;
-            } else {
-                first_buffer_size = o_buffer_size - (o_wipe_offset & (o_buffer_size - 1));
-                last_buffer_size = (o_wipe_offset + o_wipe_length) & (o_buffer_size - 1);
-                if (!last_buffer_size) last_buffer_size = o_buffer_size;
+struct walk_dir {
+    DIR *d;
+    char *path;		/* from the current directory, for messages and the plan */
+    char *name;		/* in its parent */
+    struct stat st;
+    int failed;		/* set by the jobs queued from it */
+    int r;
+    int plan;		/* its index in the plan */
+};
+
+/* failure flag of the directory being walked, for the jobs queued from it */
+static int *recursive_failed = 0;
+
+/* the type of a directory entry, as S_IFMT bits, or 0 if the file
+ * system does not tell */
+
+static mode_t dirent_mode (struct dirent *de)
+{
+#if defined(DT_UNKNOWN) && defined(DTTOIF)
+    if (de->d_type != DT_UNKNOWN) return DTTOIF(de->d_type);
+#endif
+    return 0;
+}
+
+/* opens the directory fn in dfd, whose status is st, making it u+rwx
+ * first if -c says so */
+
+static DIR *walk_open (int dfd, char *fn, struct stat *st)
+{
+    DIR *d;
+    int fd;
+
+    /* fix on 14.02.1998 -- check r/w/x permissions on directory, fix if necessary */
+    if ((st->st_mode & 0700) != 0700) {
+        if (o_dochmod) {
+            if (o_verbose) {
+                printf ("Changing permissions from %04o to %04o\n",
+                        (int) st->st_mode, (int) st->st_mode | 0700);
+                middle_of_line = 0;
+            }
+            if (fchmodat (dfd, fn, st->st_mode | 0700, 0)) {
+                fnerror ("chmod [1]");
+                return 0;
             }
+        } else {
+            fnerrorq ("directory mode is not u+rwx; use -c option");
+            return 0;
         }
+    }
 
-        debugf ("buffers_to_wipe = %d first_buffer_size = %d last_buffer_size = %d",
-                buffers_to_wipe, first_buffer_size, last_buffer_size);
+    fd = openat (dfd, fn, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (fd < 0) {
+        if (errno == EACCES && o_dochmod) {
+            if (fchmodat (dfd, fn, st->st_mode | 0700, 0)) {
+                fnerror("chmod [2]"); return 0;
+            } else fd = openat (dfd, fn, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        } else { fnerror("opendir"); return 0; }
+    }
+    if (fd < 0) { fnerror("opendir after chmod"); return 0; }
 
-        /* initialize wipe info */
-        if (!wipe_info_initialized) {
-            init_wipe_info (&wi);
-            wipe_info_initialized = 1;
-            abort_handler = wipe_continuation_message;
-            abort_handler_arg = &wi;
-        }
+    d = fdopendir (fd);
+    if (!d) { fnerror("opendir"); close (fd); }
+    return d;
+}
 
-        /* if the possibly existing leftover random buffers
-         * from the last wipe are shorter than what we need for
-         * now, mark all of them as used.
-         *
-         * ok it's possible to have a smarter random buffer management,
-         * but it only helps on small files (i.e. files smaller than the
-         * buffer size) so it's not really worth it (in other words:
-         * you can't escape from linear asymptotic complexity:)
-         */
+/* wipes, queues or plans fn in the directory dfd, whose path is dir;
+ * fn is not a directory and mode is its type.  st is its status or, if
+ * readdir () gave its type, that of its directory: enough to know its
+ * disk. */
 
-        {
-            int x;
+static int walk_file (int dfd, char *fn, char *dir, mode_t mode, struct stat *st)
+{
+    int rc;
+
+    if (S_ISREG(mode)) {
+        if (o_elevator) return plan_file (dfd, fn, dir, st);
+        if (o_jobs > 1) {
+            int jfd = dfd;
+
+            if (jfd != AT_FDCWD && (jfd = dup (dfd)) < 0) { fnerror ("dup"); return -1; }
+            pool_submit (jfd, job_path (0, fn), recursive_failed, 0, st);
+            return 0;
+        }
+        job_failed = recursive_failed;
+        rc = dothejob (dfd, fn);
+        job_failed = 0;
+        abort_handler = NULL;
+        return rc;
+    } else if (S_ISLNK(mode)) { num_symlinks ++; }
+    else {
+        if (o_verbose) {
+            printf ("Not wiping special file %s in recursive mode\n",
+                    fn);
+            middle_of_line = 0;
+        }
+        num_spec ++;
+    }
+    if (do_remove (dfd, fn)) { fnerror ("remove"); return -1; }
+    return 0;
+}
+
+/* pushes the directory fn of dfd, whose path is path, on the stack */
 
-            if (buffers_to_wipe <= 2)
-                x = max (first_buffer_size, last_buffer_size);
-            else
-                x = o_buffer_size;
+static struct walk_dir *walk_push (int dfd, char *fn, char *path, struct stat *st)
+{
+    struct walk_dir *w;
 
-            if (x > wi.random_length)
-                dirty_all_buffers (&wi);
+    if (o_verbose) {
+        printf ("Entering directory '%s'\n", path);
+        middle_of_line = 0;
+    }
 
-            wi.random_length = x;
+    w = xmalloc (sizeof (*w));
+    memset (w, 0, sizeof (*w));
+    w->plan = -1;
+    w->d = walk_open (dfd, fn, st);
+    if (!w->d) { free (w); return 0; }
+    w->path = job_path (0, path);
+    w->name = w->path + strlen (w->path) - strlen (fn);
+    w->st = *st;
+
+    if (o_elevator) {
+        w->plan = plan_dir (w->path);
+        if (w->plan < 0) {
+            closedir (w->d);
+            free (w->path);
+            free (w);
+            return 0;
         }
+    }
 
-        debugf ("buffers_to_wipe = %d, o_buffer_size = %d, wi.n_passes = %d",
-                buffers_to_wipe, o_buffer_size, wi.n_passes);
+    num_dirs ++;
+    recursive_failed = &w->failed;
+    plan.dir = w->plan;
+    return w;
+}
 
-        /* do the passes */
-        eta_begin();
-        for (i = o_skip_passes; i<wi.n_passes; i++) {
-            ssize_t wr;
+/*** walkers */
 
-            wi.current_pass = i;
+/* with --walkers=N, N threads walk the tree and hand its regular files
+ * to the worker pool.  each walker keeps the directories it finds in a
+ * deque of its own: it takes the newest one from there, which keeps the
+ * walk depth-first, and once it runs out it steals the oldest one of
+ * another walker, which is the root of the largest subtree left.
+ *
+ * a directory is removed by whichever thread finishes the last thing
+ * pending in it: its own scan, a subdirectory, or a file, which is done
+ * once its name is gone from the batch of its worker.  a directory keeps
+ * its descriptor open from its scan until then, for the jobs queued from
+ * it and the removal of its subdirectories. */
+
+struct walk_node {
+    struct walk_node *parent;
+    int fd;		/* once scanned */
+    char *path;		/* from the current directory */
+    char *name;		/* in its parent, within path */
+    struct stat st;
+    int pending;	/* its scan, its subdirectories and its files */
+    int failed;		/* something in it could not be removed */
+};
 
-            if (!o_silent) {
-                if (o_quick) 
-                    fprintf (stderr, "\rWipoing %.32s, pass %d in quick mode   ", fn, i);
-                else
-                    fprintf (stderr, "\rWiping %.32s, pass %-2d (%-2d)   ", fn, i, p[i]);
-                middle_of_line = 1;
-            }
+struct walker {
+    pthread_mutex_t lock;
+    struct walk_node **q;	/* q[head] is the oldest */
+    int head, tail, max;
+    pthread_t thread;
+};
 
-            lseek (fd, o_wipe_offset, SEEK_SET);
-
-            if (!o_silent) lt = time (0);
-
-            for (j = 0; j<buffers_to_wipe; j ++) {
-                if (!j) this_buffer_size = first_buffer_size;
-                else if (j + 1 == buffers_to_wipe) this_buffer_size = last_buffer_size;
-                else this_buffer_size = o_buffer_size;
-
-                if (!o_silent) {
-                    t = time (0);
-                    if ((bpi && (t-lt)) || ((t-lt>2) && j<(buffers_to_wipe>>1))) {
-                        char buf1[30];
-                        char buf1_bs[sizeof (buf1)];
-                        char buf2[18];
-                        char buf2_bs[sizeof(buf2)];
-                        snprintf(buf1, sizeof(buf1),
-                                "[%8ld / %8ld]", (long) j, (long)buffers_to_wipe);
-                        backspace(buf1_bs, buf1);
-                        eta_progress(buf2, sizeof(buf2),
-                            ((double) (i - o_skip_passes) + ((double)j / buffers_to_wipe)) / (wi.n_passes - o_skip_passes));
-                        if (buf2[0])
-                            pad(buf2, sizeof(buf2));
-                        backspace(buf2_bs, buf2);
-                        fprintf(stderr, "%s%s%s%s", buf1, buf2, buf2_bs,
-                            buf1_bs);
-                        fflush (stderr);
-                        lt = t;
-                        bpi = 1;
-                    }
-                }
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t more;
+    int queued;		/* directories in the deques */
+    int scanning;	/* directories being scanned */
+    int failed;		/* the root could not be removed */
+    int n;
+    struct walker w[MAX_JOBS];
+} walk;
+
+static struct walk_node *walk_node (struct walk_node *parent, char *fn, struct stat *st)
+{
+    struct walk_node *w;
+
+    w = xmalloc (sizeof (*w));
+    w->parent = parent;
+    w->fd = -1;
+    w->path = job_path (parent ? parent->path : 0, fn);
+    w->name = w->path + strlen (w->path) - strlen (fn);
+    w->st = *st;
+    w->pending = 1;
+    w->failed = 0;
+    return w;
+}
 
-                /* get a fresh random buffer */
-                {
-                    if (o_quick || !wi.passes[p[i]]) {
-                        wpb = get_random_buffer (&wi);
-                    } else {
-                        wpb = wi.passes[p[i]];
-                    }
+/* one thing pending in w is finished; removes w, then its parents, when
+ * nothing is left in them */
 
-                    for (;;) {
-                        wr = write (fd, wpb->buffer,
-                                this_buffer_size); /* asynchronous write */
+static void walk_done (struct walk_node *w, int failed)
+{
+    struct walk_node *up;
+    char *fn;
+
+    for (; w; w = up) {
+        if (failed) __atomic_store_n (&w->failed, 1, __ATOMIC_RELAXED);
+        if (__atomic_sub_fetch (&w->pending, 1, __ATOMIC_ACQ_REL)) return;
+
+        up = w->parent;
+        fn = w->path;
+        failed = __atomic_load_n (&w->failed, __ATOMIC_RELAXED);
+        if (w->fd >= 0) close (w->fd);
+        if (!failed && !o_no_remove &&
+                unlinkat (up ? up->fd : AT_FDCWD, up ? w->name : w->path, AT_REMOVEDIR)) {
+            fnerror ("rmdir");
+            failed = 1;
+        }
+        if (!up && failed) walk.failed = 1;
+        free (w->path);
+        free (w);
+    }
+}
 
-                        if (wr < 0) {
-                            if (errno == EAGAIN) {
-                                /* since we are idle we can do some socially useful
-                                 * work.
-                                 */
-                                if (revitalize_random_buffers (&wi)) {
-                                    /* there isn't anything we can do to occupy ourselves,
-                                     * so we'll just wait until our previous write requests
-                                     * are queued, and retry.
-                                     */
-                                    FD_ZERO (&w_fd);
-                                    FD_SET (fd, &w_fd);
-                                    if (select (fd + 1, 0, &w_fd, 0, 0) < 0) {
-                                        fnerror ("select");
-                                        close (fd);
-                                        return -1;
-                                    }
+static void walk_queue (struct walker *me, struct walk_node *w)
+{
+    pthread_mutex_lock (&me->lock);
+    if (me->tail == me->max) {
+        /* slide down what has been stolen, or grow */
+        if (me->head) memmove (me->q, me->q + me->head, (me->tail - me->head) * sizeof (*me->q));
+        me->tail -= me->head;
+        me->head = 0;
+        if (me->tail == me->max) {
+            me->max = me->max ? 2 * me->max : 64;
+            me->q = realloc (me->q, me->max * sizeof (*me->q));
+            if (!me->q) { fprintf (stderr, "out of memory for the walk\n"); exit (EXIT_FAILURE); }
+        }
+    }
+    me->q[me->tail ++] = w;
+    pthread_mutex_unlock (&me->lock);
 
-                                    /* we MUST have FD_ISSET(&w_fd) */
-                                }
-                            } else {
-                                fnerror ("write error");
-                                exit (EXIT_FAILURE);
-                            }
-                        } else if (wr != this_buffer_size) {
-                            /* argh short write... what does this mean exactly with
-                             * non-blocking i/o ? */
-                            debugf ("short write, expecting %d got %d",
-                                    this_buffer_size, wr);
-                            fnerror ("short write");
-                            close (fd);
-                            return -1;
-                        } else break;
-                    }
-                }
+    pthread_mutex_lock (&walk.lock);
+    walk.queued ++;
+    pthread_cond_signal (&walk.more);
+    pthread_mutex_unlock (&walk.lock);
+}
 
-#ifndef HAVE_OSYNC
-                if (fsync (fd)) {
-                    fnerror ("fsync error [1]");
-                    close (fd);
-                    return -1;
-                }
-#endif
-            }
+/* the newest directory of me, else the oldest of another walker */
 
-            if (fsync (fd)) {
-                fnerror ("fsync error [2]");
-                close (fd);
-                return -1;
-            }
-        }
+static struct walk_node *walk_take (struct walker *me)
+{
+    struct walk_node *w = 0;
+    struct walker *v;
+    int i;
 
-        /* skipping parameters are only meant for first file */
-        o_skip_passes = 0;
-        o_pass_order[0] = 1;
+    for (i = 0; i<walk.n && !w; i++) {
+        v = &walk.w[(me - walk.w + i) % walk.n];
+        pthread_mutex_lock (&v->lock);
+        if (v->head < v->tail) w = v == me ? v->q[-- v->tail] : v->q[v->head ++];
+        pthread_mutex_unlock (&v->lock);
+    }
+    if (!w) return 0;
 
-        /* try to wipe out file size by truncating at various sizes... */
+    pthread_mutex_lock (&walk.lock);
+    walk.queued --;
+    walk.scanning ++;
+    pthread_mutex_unlock (&walk.lock);
+    return w;
+}
 
-skip_wipe:    
-        if (S_ISREG(st.st_mode) && !o_dont_wipe_filesizes) {
-            off_t s;
-            u32 x;
+/* queues the subdirectories of w and the regular files, removes the rest */
 
-            s = st.st_size;
-            x = rand_Get32 ();
+static void walk_scan (struct walker *me, struct walk_node *w)
+{
+    struct walk_node *up = w->parent, *c;
+    struct dirent *de;
+    struct stat st, *sp;
+    char *fn = w->name;
+    int failed = 0;
+    mode_t mode;
+    DIR *d;
+
+    if (o_verbose) {
+        printf ("Entering directory '%s'\n", w->path);
+        middle_of_line = 0;
+    }
 
-            while (s) {
-                s >>= 1;
-                x >>= 1;
-                if (x & 1) {
-                    if (ftruncate (fd, s)) {
-                        fnerror ("truncate");
-                        close (fd);
-                        return -1;
-                    }
-                }
+    d = walk_open (up ? up->fd : AT_FDCWD, up ? w->name : w->path, &w->st);
+    if (!d) { walk_done (w, 1); return; }
+    w->fd = dup (dirfd (d));
+    if (w->fd < 0) { fnerror ("dup"); closedir (d); walk_done (w, 1); return; }
+    num_dirs ++;
+
+    for (;;) {
+        errno = 0;
+        if (!(de = readdir (d))) break;
+        fn = de->d_name;
+        if (!strcmp (fn, ".") || !strcmp (fn, "..")) continue;
+
+        mode = dirent_mode (de);
+        sp = &w->st;
+        if (!mode || S_ISDIR(mode)) {
+            if (fstatat (w->fd, fn, &st, AT_SYMLINK_NOFOLLOW)) {
+                fnerror ("stat error");
+                failed = 1;
+                continue;
             }
+            mode = st.st_mode;
+            sp = &st;
         }
 
-        close (fd);
+        if (S_ISDIR(mode) || S_ISREG(mode))
+            __atomic_add_fetch (&w->pending, 1, __ATOMIC_RELAXED);
+
+        if (S_ISDIR(mode)) {
+            c = walk_node (w, fn, sp);
+            walk_queue (me, c);
+        } else if (S_ISREG(mode)) {
+            pool_submit (w->fd, job_path (0, fn), 0, w, sp);
+        } else {
+            if (S_ISLNK(mode)) num_symlinks ++;
+            else {
+                if (o_verbose) {
+                    printf ("Not wiping special file %s in recursive mode\n", fn);
+                    middle_of_line = 0;
+                }
+                num_spec ++;
+            }
+            if (do_remove (w->fd, fn)) { fnerror ("remove"); failed = 1; }
+        }
     }
+    fn = w->path;
+    if (errno) { fnerror ("readdir"); failed = 1; }
+    closedir (d);
 
-    /* if this is a symbolic link, then remove the target of the link */
-    /* of course, we have a race condition here. */
-    /* no user should be able to control a link you're wiping... */
-    if (o_dereference_symlinks) {
-        struct stat st2;
+    /* the names of the links and special files go before w can */
+    names_flush ();
+    walk_done (w, failed);
+}
 
-        if (lstat (fn, &st2)) {
-            fnerror("lstat error");
-            return -1;
+static void *walk_thread (void *a)
+{
+    struct walker *me = a;
+    struct walk_node *w;
+
+    /* after the generators of the workers */
+    rand_InitThread (MAX_JOBS + 1 + (me - walk.w));
+
+    for (;;) {
+        if ((w = walk_take (me))) {
+            walk_scan (me, w);
+            pthread_mutex_lock (&walk.lock);
+            if (!-- walk.scanning && !walk.queued) pthread_cond_broadcast (&walk.more);
+            pthread_mutex_unlock (&walk.lock);
+            continue;
         }
-        if (S_ISLNK(st2.st_mode)) {
-            int m;
-            char buf[NAME_MAX+1];
 
-            num_symlinks ++;
-            m = readlink (fn, buf, NAME_MAX);
-            if (m < 0) {
-                fnerror ("readlink");
-                return -1;
-            }
-            buf[m] = 0;
-            if (do_remove (buf)) { fnerror("remove"); return -1; }
+        pthread_mutex_lock (&walk.lock);
+        if (!walk.queued && !walk.scanning) {
+            pthread_mutex_unlock (&walk.lock);
+            break;
         }
+        /* a directory may be on its way into a deque */
+        if (walk.queued) {
+            pthread_mutex_unlock (&walk.lock);
+            sched_yield ();
+            continue;
+        }
+        pthread_cond_wait (&walk.more, &walk.lock);
+        pthread_mutex_unlock (&walk.lock);
     }
 
-    /* remove link or file */
-    if (do_remove (fn)) { fnerror("remove"); return -1; }
+    pthread_mutex_lock (&pool.lock);
+    pool.num_errors += num_errors;
+    pool.num_dirs += num_dirs;
+    pool.num_spec += num_spec;
+    pool.num_symlinks += num_symlinks;
+    pthread_mutex_unlock (&pool.lock);
+    return 0;
+}
 
-    if (!o_silent) {
-        fprintf (stderr, "\r                                                                              \r");
-        middle_of_line = 0;
-    }
+/* walks the directory fn, whose status is st, with o_walkers threads */
 
-    if (S_ISLNK(st.st_mode)) {
-        num_symlinks ++;
-        if (o_verbose) {
-            printf ("Not following symbolic link %.32s\n", fn);
-            middle_of_line = 0;
-        }
-    } else {
-        num_files ++;
-        if (o_verbose) {
-            printf ("File %.32s (%ld bytes) wiped\n", fn, (long) st.st_size);
-            middle_of_line = 0;
+static int walk_tree (char *fn, struct stat *st)
+{
+    int i;
+
+    memset (&walk, 0, sizeof (walk));
+    pthread_mutex_init (&walk.lock, 0);
+    pthread_cond_init (&walk.more, 0);
+    walk.n = o_walkers;
+    for (i = 0; i<walk.n; i++) pthread_mutex_init (&walk.w[i].lock, 0);
+
+    walk_queue (&walk.w[0], walk_node (0, fn, st));
+
+    for (i = 0; i<walk.n; i++) {
+        if (pthread_create (&walk.w[i].thread, 0, walk_thread, &walk.w[i])) {
+            fprintf (stderr, "could not start walker threads");
+            exit (EXIT_FAILURE);
         }
     }
-    return 0;
+    for (i = 0; i<walk.n; i++) {
+        pthread_join (walk.w[i].thread, 0);
+        free (walk.w[i].q);
+    }
+
+    /* the last files, then the directories, go with the jobs */
+    pool_wait ();
+    return walk.failed ? -1 : 0;
 }
 
+/* walkers ***/
+
 int recursive (char *fn)
 {
-    int r = 0;
-    struct stat st;
-    char *olddir;
+    struct walk_dir **stack = 0, *w, *up;
+    struct dirent *de;
+    struct stat st, *sp;
+    int n = 0, max = 0, r = 0, done, dfd;
+    int outer_dir = plan.dir, *outer_failed = recursive_failed;
+    char *path;
+    mode_t mode;
 
     if (!strcmp(fn,".") || !strcmp(fn,"..")) {
         printf("Will not remove %s\n", fn);
         return 0;
     }
 
-    if (!strcmp(fn,".") || !strcmp(fn,"..")) {
-        printf("Will not remove %s\n", fn);
-        return 0;
-    }
+    if (fstatat (AT_FDCWD, fn, &st, AT_SYMLINK_NOFOLLOW)) { fnerror ("stat error"); return -1; }
+    if (!S_ISDIR(st.st_mode)) return walk_file (AT_FDCWD, fn, 0, st.st_mode, &st);
+    if (o_walkers > 1) return walk_tree (fn, &st);
 
-    if (lstat (fn, &st)) { fnerror ("stat error"); return -1; }
+    if (!(w = walk_push (AT_FDCWD, fn, fn, &st))) return -1;
+    stack = xmalloc ((max = 16) * sizeof (*stack));
+    stack[n ++] = w;
 
-    if (S_ISDIR(st.st_mode)) {
-        DIR *d;
-        struct dirent *de;
+    while (n) {
+        w = stack[n - 1];
+        dfd = dirfd (w->d);
 
-        olddir = getcwd (0, 4096);
-        if (!olddir) { fnerror("getcwd"); return -1; }
+        done = o_errorabort && (w->r || __atomic_load_n (&w->failed, __ATOMIC_RELAXED));
+        errno = 0;
+        if (!done && (de = readdir (w->d))) {
+            fn = de->d_name;
+            if (!strcmp (fn, ".") || !strcmp (fn, "..")) continue;
+
+            mode = dirent_mode (de);
+            sp = &w->st;
+            if (!mode || S_ISDIR(mode)) {
+                if (fstatat (dfd, fn, &st, AT_SYMLINK_NOFOLLOW)) {
+                    fnerror ("stat error");
+                    w->r = -1;
+                    continue;
+                }
+                mode = st.st_mode;
+                sp = &st;
+            }
 
-        if (o_verbose) {
-            printf ("Entering directory '%s'\n", fn);
-            middle_of_line = 0;
-        }
+            if (!S_ISDIR(mode)) {
+                if (walk_file (dfd, fn, w->path, mode, sp)) w->r = -1;
+                continue;
+            }
 
-        /* fix on 14.02.1998 -- check r/w/x permissions on directory, fix if necessary */
-        if ((st.st_mode & 0700) != 0700) {
-            if (o_dochmod) {
-                if (o_verbose) {
-                    printf ("Changing permissions from %04o to %04o\n",
-                            (int) st.st_mode, (int) st.st_mode | 0700);
-                    middle_of_line = 0;
-                }
-                if (chmod (fn, st.st_mode | 0700)) {
-                    fnerror ("chmod [1]");
-                    return -1;
-                }
-            } else {
-                fnerrorq ("directory mode is not u+rwx; use -c option");
-                return -1;
+            path = job_path (w->path, fn);
+            up = walk_push (dfd, fn, path, sp);
+            free (path);
+            if (!up) { w->r = -1; continue; }
+            if (n == max) {
+                stack = realloc (stack, (max *= 2) * sizeof (*stack));
+                if (!stack) { fnerrorq ("out of memory for the directory stack"); exit (EXIT_FAILURE); }
             }
+            stack[n ++] = up;
+            continue;
         }
 
-        d = opendir (fn);
-        if (!d) {
-            if (errno == EACCES && o_dochmod) {
-                if (chmod (fn, st.st_mode | 0700)) {
-                    fnerror("chmod [2]"); return -1;
-                } else d = opendir (fn);
-            } else { fnerror("opendir"); return -1; }
-        }
-        if (!d) { fnerror("opendir after chmod"); return -1; }
+        /* end of the directory w */
+        fn = w->path;
+        if (!done && errno) { fnerror ("readdir"); w->r = -1; }
 
-        if (chdir (fn)) { fnerror("chdir"); return -1; }
+        /* the files of this directory must be gone before it can be removed */
+        if (o_jobs > 1) pool_wait ();
+        group_flush ();
+        if (w->failed) w->r = -1;
+        /* the renames of its files must be done before it can go */
+        names_flush ();
+        closedir (w->d);
 
-        errno = 0;
-        num_dirs ++;
-
-        while ((de = readdir (d))) {
-            if (strcmp (de->d_name, ".") && strcmp (de->d_name, "..")) {
-                if (recursive (de->d_name)) {
-                    /* num_errors ++; */
-                    r = -1;
-                    if (o_errorabort) break;
-                }
-            }
-            errno = 0;
-        }
+        n --;
+        up = n ? stack[n - 1] : 0;
+        recursive_failed = up ? &up->failed : outer_failed;
+        plan.dir = up ? up->plan : outer_dir;
 
-        if (errno) { fnerror("readdir"); return -1; }
-        closedir (d);
         if (o_verbose) {
-            printf ("Going back to directory %s\n", olddir);
+            printf ("Leaving directory '%s'\n", w->path);
             middle_of_line = 0;
         }
-        if (chdir (olddir)) { fnerror("chdir .."); return -1; }
-        free (olddir);
-        if (!r && !o_no_remove && rmdir (fn)) { fnerror ("rmdir"); return -1; }	
-    } else {
-        if (S_ISREG(st.st_mode)) {
-            int rc = dothejob (fn);
-            abort_handler = NULL;
-            return rc;
-        } else if (S_ISLNK(st.st_mode)) { num_symlinks ++; }
-        else { 
-            if (o_verbose) {
-                printf ("Not wiping special file %s in recursive mode\n",
-                        fn);
-                middle_of_line = 0;
-            }
-            num_spec ++;
+
+        /* planned directories are removed by plan_run () */
+        if (w->r && o_elevator) plan.dirs[w->plan].failed = 1;
+        if (!w->r && !o_no_remove && !o_elevator &&
+                unlinkat (up ? dirfd (up->d) : AT_FDCWD, up ? w->name : w->path, AT_REMOVEDIR)) {
+            fnerror ("rmdir");
+            w->r = -1;
+        }
+        if (w->r) {
+            if (up) up->r = -1;
+            else r = -1;
         }
-        if (do_remove (fn)) { fnerror ("remove"); return -1; }	
+        free (w->path);
+        free (w);
     }
 
+    free (stack);
     return r;
 }
 
+/* recursive ***/
+
 /* dothejob ***/
 
 /*** banner */
@@ -1276,7 +4850,62 @@ void banner ()
 
 /* banner ***/
 
-#define OPTSTR "x:X:DfhvrqspciR:S:M:kFZl:o:b:Q:T:P:e"
+#define OPTSTR "x:X:DfhvrqspciR:S:M:kFZl:o:b:Q:T:P:ej:"
+
+/* long options have no single-character equivalent */
+
+#define OPT_GENERATORS 256
+#define OPT_ENGINE 257
+#define OPT_QUEUE_DEPTH 258
+#define OPT_DIRECT 259
+#define OPT_STRIPES 260
+#define OPT_DEVICE_JOBS 261
+#define OPT_WRITEBACK 262
+#define OPT_MEM_LIMIT 263
+#define OPT_HUGE_PAGES 264
+#define OPT_OFFLOAD 265
+#define OPT_DISCARD 266
+#define OPT_FILL_HOLES 267
+#define OPT_ELEVATOR 268
+#define OPT_WALKERS 269
+#define OPT_GROUP 270
+#define OPT_JOURNAL 271
+#define OPT_RESUME 272
+#define OPT_VERIFY 273
+#define OPT_VERIFY_SAMPLE 274
+#define OPT_PROGRESS_FD 275
+
+#ifdef HAVE_GETOPT_LONG
+static struct option long_options[] = {
+    { "generators",	required_argument,	0, OPT_GENERATORS },
+    { "engine",		required_argument,	0, OPT_ENGINE },
+    { "queue-depth",	required_argument,	0, OPT_QUEUE_DEPTH },
+#ifdef HAVE_O_DIRECT
+    { "direct",		no_argument,		0, OPT_DIRECT },
+#endif
+    { "stripes",	required_argument,	0, OPT_STRIPES },
+    { "device-jobs",	required_argument,	0, OPT_DEVICE_JOBS },
+#ifdef HAVE_SYNC_FILE_RANGE
+    { "writeback",	required_argument,	0, OPT_WRITEBACK },
+#endif
+    { "mem-limit",	required_argument,	0, OPT_MEM_LIMIT },
+#ifdef HAVE_HUGE_PAGES
+    { "huge-pages",	no_argument,		0, OPT_HUGE_PAGES },
+#endif
+    { "offload",	no_argument,		0, OPT_OFFLOAD },
+    { "discard",	no_argument,		0, OPT_DISCARD },
+    { "fill-holes",	no_argument,		0, OPT_FILL_HOLES },
+    { "elevator",	no_argument,		0, OPT_ELEVATOR },
+    { "walkers",	required_argument,	0, OPT_WALKERS },
+    { "group",		required_argument,	0, OPT_GROUP },
+    { "journal",	required_argument,	0, OPT_JOURNAL },
+    { "resume",		no_argument,		0, OPT_RESUME },
+    { "verify",		optional_argument,	0, OPT_VERIFY },
+    { "verify-sample",	required_argument,	0, OPT_VERIFY_SAMPLE },
+    { "progress-fd",	required_argument,	0, OPT_PROGRESS_FD },
+    { 0, 0, 0, 0 }
+};
+#endif
 
 /*** reject and usage */
 
@@ -1309,11 +4938,13 @@ void usage (void)
             "\t\t-F Do not attempt to wipe filenames\n"
             "\t\t-h Display this help\n"
             "\t\t-i Informative (verbose) mode\n"
+            "\t\t-j <jobs> Wipe up to <jobs> files at the same time, 0 for one\n"
+            "\t\t\tper disk\n"
             "\t\t-k Keep files, i.e. do not remove() them after overwriting\n"
             "\t\t-l <length> Set wipe length to <length> bytes, where <length> is\n"
             "\t\t\tan integer followed by K (Kilo:1024), M (Mega:K^2) or\n"
             "\t\t\tG (Giga:K^3)\n"
-            "\t\t-M (l|r) Set PRNG algorithm for filling blocks (and ordering passes)\n"
+            "\t\t-M (l|r|a|c|A) Set PRNG algorithm for filling blocks (and ordering passes)\n"
             "\t\t\tl Use libc's "
 #ifdef HAVE_RANDOM
                 "random()"
@@ -1325,6 +4956,8 @@ void usage (void)
             "\t\t\tr Use RC6 encryption algorithm\n"
 #endif
             "\t\t\ta Use arcfour encryption algorithm\n"
+            "\t\t\tc Use ChaCha20 stream cipher (SIMD-accelerated, default)\n"
+            "\t\t\tA Use AES-128 in counter mode (AES-NI accelerated)\n"
             "\t\t-o <offset> Set wipe offset to <offset>, where <offset> has the\n"
             "\t\t\tsame format as <length>\n"
             "\t\t-P <passes> Set number of passes for filename wiping.\n"
@@ -1343,7 +4976,48 @@ void usage (void)
             "\t\t-v Show version information\n"
             "\t\t-Z Do not attempt to wipe file size\n"
             "\t\t-X <number> Skip this number of passes (useful for continuing a wiping operation)\n"
-            "\t\t-x <pass1,pass2,...> Define pass order\n",
+            "\t\t-x <pass1,pass2,...> Define pass order\n"
+#ifdef HAVE_GETOPT_LONG
+            "\t\t--generators=<n> Number of threads generating random data\n"
+            "\t\t\tahead of the writes (with -M c or A); default is 1,\n"
+            "\t\t\t0 generates it inline\n"
+#ifdef HAVE_IO_URING
+            "\t\t--engine=(sync|uring) Write with write() (default) or\n"
+            "\t\t\tkeep several writes in flight with io_uring\n"
+            "\t\t--queue-depth=<n> Writes in flight with io_uring (default 8)\n"
+#endif
+#ifdef HAVE_O_DIRECT
+            "\t\t--direct Write with O_DIRECT, bypassing the page cache\n"
+#endif
+            "\t\t--stripes=<n> Split each file or device into n stripes\n"
+            "\t\t\twritten in parallel (with -M c or A)\n"
+            "\t\t--device-jobs=<n> With -j, wipe up to n files of the same\n"
+            "\t\t\tdisk at the same time; default is 1\n"
+#ifdef HAVE_SYNC_FILE_RANGE
+            "\t\t--writeback=<length> Push data to the disk in windows of\n"
+            "\t\t\t<length> bytes (default 8M); 0 writes with O_SYNC\n"
+#endif
+            "\t\t--mem-limit=<length> Keep the buffers of all jobs under\n"
+            "\t\t\t<length> bytes\n"
+#ifdef HAVE_HUGE_PAGES
+            "\t\t--huge-pages Back large buffers with huge pages\n"
+#endif
+            "\t\t--offload Let the kernel write zero passes (BLKZEROOUT,\n"
+            "\t\t\tFALLOC_FL_ZERO_RANGE)\n"
+            "\t\t--discard Discard the region after the last pass\n"
+            "\t\t--fill-holes Write the holes of sparse files too\n"
+            "\t\t--elevator With -r, wipe files in the order of their\n"
+            "\t\t\tplace on disk\n"
+            "\t\t--walkers=<n> With -r and -j, walk the tree with n threads\n"
+            "\t\t--group=<n> Wipe files that fit in a buffer n at a time,\n"
+            "\t\t\twith one syncfs () per pass\n"
+            "\t\t--journal=<file> Record the progress of the wipe in file\n"
+            "\t\t--resume Carry on with the wipe recorded by --journal\n"
+            "\t\t--verify[=last|all] Read back the last pass, or all of them\n"
+            "\t\t--verify-sample=<p> Read back p%% of the last pass, at random\n"
+            "\t\t--progress-fd=<n> Write progress to descriptor n as JSON lines\n"
+#endif
+            ,
             progname
         );
 
@@ -1418,7 +5092,11 @@ int main (int argc, char **argv)
     /* parse options */
 
     for (;;) {
+#ifdef HAVE_GETOPT_LONG
+        c = getopt_long (argc, argv, OPTSTR, long_options, 0);
+#else
         c = getopt (argc, argv, OPTSTR);
+#endif
         if (c<0) break;
 
         switch (c) {
@@ -1479,6 +5157,11 @@ int main (int argc, char **argv)
             case 'T': o_name_max_tries = atoi (optarg); break;
             case 'v': banner (); exit (0);
             case 'Z': o_dont_wipe_filesizes = 1; break;
+            case 'j':
+                      o_jobs = atoi (optarg);
+                      if (o_jobs < 0 || o_jobs > MAX_JOBS)
+                          reject ("number of jobs must be between 0 and %d", MAX_JOBS);
+                      break;
             case 'b':
                       o_lg2_buffer_size = atoi (optarg);
                       if (o_lg2_buffer_size < 9)
@@ -1538,11 +5221,99 @@ int main (int argc, char **argv)
 #endif
                             case 'a':
                                 o_randalgo = RANDA_ARCFOUR; break;
+                            case 'c':
+                                o_randalgo = RANDA_CHACHA; break;
+                            case 'A':
+                                o_randalgo = RANDA_AES; break;
                             default:
                                 reject ("unknown random seed method, see help");
                                 break;
                         }
                         break;
+            case OPT_GENERATORS:
+                        o_generators = atoi (optarg);
+                        if (o_generators < 0 || o_generators > 64)
+                            reject ("number of generator threads must be between 0 and 64");
+                        break;
+            case OPT_ENGINE:
+                        if (!strcmp (optarg, "sync")) o_engine = ENGINE_SYNC;
+#ifdef HAVE_IO_URING
+                        else if (!strcmp (optarg, "uring")) o_engine = ENGINE_URING;
+#endif
+                        else reject ("unknown write engine \"%s\"", optarg);
+                        break;
+            case OPT_QUEUE_DEPTH:
+                        o_queue_depth = atoi (optarg);
+                        if (o_queue_depth < 1 || o_queue_depth > RANDOM_BUFFERS)
+                            reject ("queue depth must be between 1 and %d", RANDOM_BUFFERS);
+                        break;
+            case OPT_DIRECT:
+                        o_direct = 1;
+                        break;
+            case OPT_STRIPES:
+                        o_stripes = atoi (optarg);
+                        if (o_stripes < 1 || o_stripes > MAX_STRIPES)
+                            reject ("number of stripes must be between 1 and %d", MAX_STRIPES);
+                        break;
+            case OPT_WRITEBACK:
+                        if (parse_length_offset_description (optarg, &o_writeback))
+                            exit (EXIT_FAILURE);
+                        break;
+            case OPT_OFFLOAD:
+                        o_offload = 1;
+                        break;
+            case OPT_DISCARD:
+                        o_discard = 1;
+                        break;
+            case OPT_ELEVATOR:
+                        o_elevator = 1;
+                        break;
+            case OPT_FILL_HOLES:
+                        o_fill_holes = 1;
+                        break;
+            case OPT_GROUP:
+                        o_group = atoi (optarg);
+                        if (o_group < 0 || o_group > MAX_GROUP)
+                            reject ("group size must be between 0 and %d", MAX_GROUP);
+                        break;
+            case OPT_JOURNAL:
+                        o_journal = optarg;
+                        break;
+            case OPT_RESUME:
+                        o_resume = 1;
+                        break;
+            case OPT_VERIFY:
+                        if (!optarg || !strcmp (optarg, "last")) o_verify = VERIFY_LAST;
+                        else if (!strcmp (optarg, "all")) o_verify = VERIFY_ALL;
+                        else reject ("--verify takes last or all, not %s", optarg);
+                        break;
+            case OPT_VERIFY_SAMPLE:
+                        o_verify_sample = strtod (optarg, 0);
+                        if (!(o_verify_sample > 0 && o_verify_sample <= 100))
+                            reject ("--verify-sample takes a percentage above 0, up to 100");
+                        break;
+            case OPT_PROGRESS_FD:
+                        o_progress_fd = atoi (optarg);
+                        if (o_progress_fd < 0 || fcntl (o_progress_fd, F_GETFL) < 0)
+                            reject ("--progress-fd: %s is not an open descriptor", optarg);
+                        break;
+            case OPT_WALKERS:
+                        o_walkers = atoi (optarg);
+                        if (o_walkers < 1 || o_walkers > MAX_JOBS)
+                            reject ("number of walkers must be between 1 and %d", MAX_JOBS);
+                        break;
+            case OPT_HUGE_PAGES:
+                        o_huge_pages = 1;
+                        break;
+            case OPT_MEM_LIMIT:
+                        if (parse_length_offset_description (optarg, &o_mem_limit))
+                            exit (EXIT_FAILURE);
+                        break;
+            case OPT_DEVICE_JOBS:
+                        o_device_jobs = atoi (optarg);
+                        if (o_device_jobs < 1)
+                            reject ("number of jobs per disk must be at least 1");
+                        break;
             case 'h':
             case '?':
             default:
@@ -1559,6 +5330,20 @@ int main (int argc, char **argv)
 
     if (o_recurse && o_dereference_symlinks) reject ("options -D and -r are mutually exclusive");
 
+    if (o_stripes > 1) {
+        if (!rand_Seekable ())
+            reject ("--stripes needs a counter-mode generator (-M c or A)");
+        if (o_engine != ENGINE_SYNC)
+            reject ("--stripes only works with --engine=sync");
+    }
+
+    if (o_resume && !o_journal) reject ("--resume needs --journal");
+    if (o_journal && o_randalgo != RANDA_CHACHA && o_randalgo != RANDA_AES)
+        reject ("--journal needs a counter-mode generator (-M c or A)");
+    if (o_verify && o_verify_sample) reject ("options --verify and --verify-sample are mutually exclusive");
+    if ((o_verify || o_verify_sample) && o_randalgo != RANDA_CHACHA && o_randalgo != RANDA_AES)
+        reject ("--verify needs a counter-mode generator (-M c or A)");
+
     /* automatic detection of a suitable random device */
 
     if (!o_randseed_set) {
@@ -1577,6 +5362,9 @@ int main (int argc, char **argv)
     /* initialise PRNG */
     rand_Init ();
 
+    /* --resume takes the seed back from the journal */
+    if (o_journal && journal_open (o_journal, o_resume)) exit (EXIT_FAILURE);
+
     /* stat specified files/directories */
 
     n = argc-optind;
@@ -1696,17 +5484,59 @@ user_aborted:
         }
     }
 
+    if (o_elevator && !o_recurse) reject ("--elevator only applies to -r");
+    if (o_walkers > 1 && !o_recurse) reject ("--walkers only applies to -r");
+    if (o_walkers > 1 && o_elevator) reject ("options --walkers and --elevator are mutually exclusive");
+
+    /* one worker per disk */
+    if (!o_jobs) {
+        for (i = optind; i<argc; i++)
+            if (!(o_dereference_symlinks ? stat : lstat) (argv[i], &st)) find_device (&st);
+        o_jobs = n_devices > 1 ? n_devices : 1;
+        if (o_jobs > MAX_JOBS) o_jobs = MAX_JOBS;
+    }
+    if (o_walkers > 1 && o_jobs <= 1) reject ("--walkers needs more than one job (-j)");
+
+    /* every job needs two random buffers besides its pattern tiles */
+    if (o_mem_limit) {
+        off_t tiles = o_quick ? 0 : MAX_BUFFERS * TILE_SIZE;
+        int b = o_buffer_size;
+
+        while (o_lg2_buffer_size > 12 && o_mem_limit / o_jobs < 2 * o_buffer_size + tiles)
+            o_buffer_size = 1 << --o_lg2_buffer_size;
+        if (o_mem_limit / o_jobs < 2 * o_buffer_size + tiles) {
+            fprintf (stderr, "--mem-limit is too low for %d jobs\n", o_jobs);
+            exit (EXIT_FAILURE);
+        }
+        if (o_buffer_size != b && !o_silent)
+            fprintf (stderr, "buffer size lowered to %d bytes by --mem-limit\n", o_buffer_size);
+    }
+
+    progress_start ();
+    if (o_jobs > 1) pool_start (o_jobs);
+
     for (i = optind; i<argc; i++) {
         int r;
 
-        if (o_recurse) r = recursive (argv[i]);
-        else r = dothejob (argv[i]);
+        if (o_jobs > 1 && !o_recurse) {
+            if (!(o_dereference_symlinks ? stat : lstat) (argv[i], &st)) {
+                pool_submit (AT_FDCWD, job_path (0, argv[i]), 0, 0, &st);
+                continue;
+            }
+            fprintf (stderr, "%s: %s\n", argv[i], strerror (errno));
+            r = -1;
+        } else if (o_recurse) r = recursive (argv[i]);
+        else r = dothejob (AT_FDCWD, argv[i]);
 
         if (r < 0) num_errors ++; /* Why or when was this disabled? -- OBD */
     }
 
+    if (o_elevator && plan_run () < 0) num_errors ++;
+
+    if (o_jobs > 1) pool_stop ();
+
     /* free internal buffers */
-    dothejob (0);
+    dothejob (AT_FDCWD, 0);
 
     /* final synchronisation */
     if (!o_silent) {
@@ -1719,6 +5549,7 @@ user_aborted:
 #else
     sync (); sleep (1); sync ();
 #endif
+    progress_stop ();
     if (!o_silent) {
         if(o_dereference_symlinks) {
             fprintf (stderr, "\rOperation finished.\n"